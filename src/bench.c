@@ -0,0 +1,210 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include "bench.h"
+
+/* Collects latency samples, in microseconds, from any thread. */
+struct _BenchStats
+{
+  gchar    *name;
+  GMutex    lock;
+  GArray   *samples;
+  gboolean  sorted;
+};
+
+BenchStats*
+bench_stats_new (const gchar *name)
+{
+  BenchStats *stats;
+
+  stats = g_new0 (BenchStats, 1);
+  stats->name = g_strdup (name);
+  g_mutex_init (&stats->lock);
+  stats->samples = g_array_new (FALSE, FALSE, sizeof (gint64));
+
+  return stats;
+}
+
+void
+bench_stats_free (BenchStats *stats)
+{
+  g_array_free (stats->samples, TRUE);
+  g_mutex_clear (&stats->lock);
+  g_free (stats->name);
+  g_free (stats);
+}
+
+void
+bench_stats_add (BenchStats *stats,
+                 gint64      usec)
+{
+  g_mutex_lock (&stats->lock);
+  g_array_append_val (stats->samples, usec);
+  stats->sorted = FALSE;
+  g_mutex_unlock (&stats->lock);
+}
+
+guint
+bench_stats_get_count (BenchStats *stats)
+{
+  guint count;
+
+  g_mutex_lock (&stats->lock);
+  count = stats->samples->len;
+  g_mutex_unlock (&stats->lock);
+
+  return count;
+}
+
+static gint
+compare_samples (gconstpointer a,
+                 gconstpointer b)
+{
+  gint64 x = *(const gint64 *) a;
+  gint64 y = *(const gint64 *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile, 0 <= @percentile <= 100. Returns -1 without
+ * samples. */
+gint64
+bench_stats_get_percentile (BenchStats *stats,
+                            gdouble     percentile)
+{
+  gint64 value = -1;
+  guint rank;
+
+  g_mutex_lock (&stats->lock);
+  if (stats->samples->len > 0) {
+    if (!stats->sorted) {
+      g_array_sort (stats->samples, compare_samples);
+      stats->sorted = TRUE;
+    }
+    rank = (guint) (percentile / 100.0 * (stats->samples->len - 1) + 0.5);
+    value = g_array_index (stats->samples, gint64,
+                           MIN (rank, stats->samples->len - 1));
+  }
+  g_mutex_unlock (&stats->lock);
+
+  return value;
+}
+
+void
+bench_stats_print (BenchStats *stats)
+{
+  if (bench_stats_get_count (stats) == 0) {
+    g_message ("%s: no samples", stats->name);
+    return;
+  }
+
+  g_message ("%s: n=%u min=%.2f p50=%.2f p90=%.2f p99=%.2f max=%.2f ms",
+             stats->name, bench_stats_get_count (stats),
+             bench_stats_get_percentile (stats, 0) / 1000.0,
+             bench_stats_get_percentile (stats, 50) / 1000.0,
+             bench_stats_get_percentile (stats, 90) / 1000.0,
+             bench_stats_get_percentile (stats, 99) / 1000.0,
+             bench_stats_get_percentile (stats, 100) / 1000.0);
+}
+
+/* Prints every tenth percentile and the tail, one per line, so that
+ * runs can be compared or plotted. */
+void
+bench_stats_print_distribution (BenchStats *stats)
+{
+  static const gdouble percentiles[] = {
+    10, 20, 30, 40, 50, 60, 70, 80, 90, 95, 99, 99.9, 100
+  };
+  guint i;
+
+  if (bench_stats_get_count (stats) == 0)
+    return;
+
+  for (i = 0; i < G_N_ELEMENTS (percentiles); i++)
+    g_message ("%s: p%g=%.2f ms", stats->name, percentiles[i],
+               bench_stats_get_percentile (stats, percentiles[i]) / 1000.0);
+}
+
+/* Compares every result in @group of @results with the same key in the
+ * baseline keyfile at @path, allowing it to be worse by the percentage
+ * in the group's "tolerance" key (default 10). Results missing from the
+ * baseline, as in a group not recorded yet, are only printed. */
+gboolean
+bench_check_baseline (GKeyFile     *results,
+                      const gchar  *path,
+                      const gchar  *group,
+                      guint        *regressions,
+                      GError      **error)
+{
+  GKeyFile *baseline;
+  gchar **keys;
+  gdouble tolerance = 10.0;
+  gboolean ret = FALSE;
+  guint i;
+
+  *regressions = 0;
+
+  baseline = g_key_file_new ();
+  if (!g_key_file_load_from_file (baseline, path, G_KEY_FILE_NONE, error))
+    goto out;
+  if (!g_key_file_has_group (baseline, group)) {
+    g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                 "No group '%s' in %s", group, path);
+    goto out;
+  }
+  if (g_key_file_has_key (baseline, group, "tolerance", NULL))
+    tolerance = g_key_file_get_double (baseline, group, "tolerance", NULL);
+
+  keys = g_key_file_get_keys (results, group, NULL, NULL);
+  for (i = 0; keys != NULL && keys[i] != NULL; i++) {
+    gdouble value, expected, limit;
+    gboolean ok;
+
+    value = g_key_file_get_double (results, group, keys[i], NULL);
+    if (!g_key_file_has_key (baseline, group, keys[i], NULL)) {
+      g_message ("%s: %s=%.2f (no baseline)", group, keys[i], value);
+      continue;
+    }
+
+    expected = g_key_file_get_double (baseline, group, keys[i], NULL);
+    /* Throughput is better higher, everything else lower. */
+    if (g_str_equal (keys[i], "fps")) {
+      limit = expected * (1.0 - tolerance / 100.0);
+      ok = value >= limit;
+    } else {
+      limit = expected * (1.0 + tolerance / 100.0);
+      ok = value <= limit;
+    }
+
+    if (ok)
+      g_message ("%s: %s=%.2f baseline=%.2f limit=%.2f ok",
+                 group, keys[i], value, expected, limit);
+    else {
+      g_warning ("%s: %s=%.2f baseline=%.2f limit=%.2f REGRESSED",
+                 group, keys[i], value, expected, limit);
+      (*regressions)++;
+    }
+  }
+  g_strfreev (keys);
+  ret = TRUE;
+
+out:
+  g_key_file_free (baseline);
+
+  return ret;
+}
@@ -0,0 +1,42 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_BENCH_H__
+#define __RELAY_BENCH_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _BenchStats BenchStats;
+
+BenchStats* bench_stats_new                (const gchar *name);
+void        bench_stats_free               (BenchStats  *stats);
+void        bench_stats_add                (BenchStats  *stats,
+                                            gint64       usec);
+guint       bench_stats_get_count          (BenchStats  *stats);
+gint64      bench_stats_get_percentile     (BenchStats  *stats,
+                                            gdouble      percentile);
+void        bench_stats_print              (BenchStats  *stats);
+void        bench_stats_print_distribution (BenchStats  *stats);
+
+gboolean    bench_check_baseline           (GKeyFile     *results,
+                                            const gchar  *path,
+                                            const gchar  *group,
+                                            guint        *regressions,
+                                            GError      **error);
+
+G_END_DECLS
+
+#endif /* __RELAY_BENCH_H__ */
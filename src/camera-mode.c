@@ -0,0 +1,186 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include "camera-mode.h"
+
+/* Modes whose aspect ratio is this many thousandths off the output's
+ * would come out stretched or letterboxed. */
+#define ASPECT_TOLERANCE 10
+
+/* Returns the size of a frame of @format at @width x @height. */
+static gsize
+frame_size (GstVideoFormat format,
+            gint           width,
+            gint           height)
+{
+  GstVideoInfo info;
+
+  gst_video_info_init (&info);
+  gst_video_info_set_format (&info, format, width, height);
+
+  return GST_VIDEO_INFO_SIZE (&info);
+}
+
+/* Estimates the bytes read and written for each output frame to stream
+ * @mode and bring it to @wanted the way the output does, converting the
+ * format at the size of the mode, then scaling. Frames in excess of the
+ * output framerate still cost their capture and conversion. */
+gdouble
+camera_mode_get_cost (const GstVideoInfo *mode,
+                      const GstVideoInfo *wanted)
+{
+  GstVideoFormat format = GST_VIDEO_INFO_FORMAT (wanted);
+  gint width = GST_VIDEO_INFO_WIDTH (mode);
+  gint height = GST_VIDEO_INFO_HEIGHT (mode);
+  gsize size = GST_VIDEO_INFO_SIZE (mode);
+  gdouble cost = size;
+
+  if (GST_VIDEO_INFO_FORMAT (mode) != format) {
+    size = frame_size (format, width, height);
+    cost += GST_VIDEO_INFO_SIZE (mode) + size;
+  }
+  if (width != GST_VIDEO_INFO_WIDTH (wanted) ||
+      height != GST_VIDEO_INFO_HEIGHT (wanted))
+    cost += size + GST_VIDEO_INFO_SIZE (wanted);
+
+  if (GST_VIDEO_INFO_FPS_N (mode) > 0 && GST_VIDEO_INFO_FPS_N (wanted) > 0)
+    cost *= (gdouble) GST_VIDEO_INFO_FPS_N (mode) *
+        GST_VIDEO_INFO_FPS_D (wanted) /
+        ((gdouble) GST_VIDEO_INFO_FPS_D (mode) *
+         GST_VIDEO_INFO_FPS_N (wanted));
+
+  return cost;
+}
+
+/* Whether frames of @mode can be brought to @wanted without upscaling,
+ * changing the aspect ratio or repeating frames. */
+static gboolean
+mode_satisfies (const GstVideoInfo *mode,
+                const GstVideoInfo *wanted)
+{
+  gint64 mode_aspect, wanted_aspect;
+
+  if (GST_VIDEO_INFO_WIDTH (mode) < GST_VIDEO_INFO_WIDTH (wanted) ||
+      GST_VIDEO_INFO_HEIGHT (mode) < GST_VIDEO_INFO_HEIGHT (wanted))
+    return FALSE;
+
+  mode_aspect = (gint64) GST_VIDEO_INFO_WIDTH (mode) *
+      GST_VIDEO_INFO_HEIGHT (wanted);
+  wanted_aspect = (gint64) GST_VIDEO_INFO_HEIGHT (mode) *
+      GST_VIDEO_INFO_WIDTH (wanted);
+  if (ABS (mode_aspect - wanted_aspect) * 1000 >
+      wanted_aspect * ASPECT_TOLERANCE)
+    return FALSE;
+
+  /* A variable framerate, given as 0/1, is taken as keeping up. */
+  return GST_VIDEO_INFO_FPS_N (mode) == 0 ||
+      (gint64) GST_VIDEO_INFO_FPS_N (mode) * GST_VIDEO_INFO_FPS_D (wanted) >=
+      (gint64) GST_VIDEO_INFO_FPS_N (wanted) * GST_VIDEO_INFO_FPS_D (mode);
+}
+
+/* Fixates @structure as close as it allows to @wanted and, if the mode
+ * it comes to satisfies @wanted for less than @best_cost, replaces
+ * @best with it. */
+static void
+mode_consider (const GstStructure  *structure,
+               const GstVideoInfo  *wanted,
+               GstCaps            **best,
+               gdouble             *best_cost)
+{
+  GstStructure *fixed;
+  GstVideoInfo info;
+  GstCaps *caps;
+  gdouble cost;
+
+  fixed = gst_structure_copy (structure);
+  gst_structure_fixate_field_nearest_int (fixed, "width",
+                                          GST_VIDEO_INFO_WIDTH (wanted));
+  gst_structure_fixate_field_nearest_int (fixed, "height",
+                                          GST_VIDEO_INFO_HEIGHT (wanted));
+  gst_structure_fixate_field_nearest_fraction (fixed, "framerate",
+                                               GST_VIDEO_INFO_FPS_N (wanted),
+                                               GST_VIDEO_INFO_FPS_D (wanted));
+  gst_structure_fixate_field_nearest_fraction (fixed, "pixel-aspect-ratio",
+                                               1, 1);
+  caps = gst_caps_fixate (gst_caps_new_full (fixed, NULL));
+
+  if (!gst_video_info_from_caps (&info, caps) ||
+      !mode_satisfies (&info, wanted)) {
+    gst_caps_unref (caps);
+    return;
+  }
+
+  cost = camera_mode_get_cost (&info, wanted);
+  GST_LOG ("%" GST_PTR_FORMAT ": %.0f bytes per frame", caps, cost);
+  if (*best != NULL && cost >= *best_cost) {
+    gst_caps_unref (caps);
+    return;
+  }
+
+  if (*best != NULL)
+    gst_caps_unref (*best);
+  *best = caps;
+  *best_cost = cost;
+}
+
+/* Picks, out of the raw video modes in @available, the one cheapest to
+ * bring to @wanted, and returns fixed caps for it with its cost in
+ * @cost, or NULL if @wanted is cheapest itself or no mode satisfies it.
+ * Every format a structure lists is a mode of its own. */
+GstCaps*
+camera_mode_select (GstCaps            *available,
+                    const GstVideoInfo *wanted,
+                    gdouble            *cost)
+{
+  GstCaps *best = NULL;
+  GstVideoInfo info;
+  guint i, j;
+
+  for (i = 0; i < gst_caps_get_size (available); i++) {
+    const GstStructure *structure = gst_caps_get_structure (available, i);
+    const GValue *formats;
+
+    if (!gst_structure_has_name (structure, "video/x-raw"))
+      continue;
+
+    formats = gst_structure_get_value (structure, "format");
+    if (formats == NULL || !GST_VALUE_HOLDS_LIST (formats)) {
+      mode_consider (structure, wanted, &best, cost);
+      continue;
+    }
+
+    for (j = 0; j < gst_value_list_get_size (formats); j++) {
+      GstStructure *copy = gst_structure_copy (structure);
+
+      gst_structure_set_value (copy, "format",
+                               gst_value_list_get_value (formats, j));
+      mode_consider (copy, wanted, &best, cost);
+      gst_structure_free (copy);
+    }
+  }
+
+  if (best != NULL && gst_video_info_from_caps (&info, best) &&
+      GST_VIDEO_INFO_FORMAT (&info) == GST_VIDEO_INFO_FORMAT (wanted) &&
+      GST_VIDEO_INFO_WIDTH (&info) == GST_VIDEO_INFO_WIDTH (wanted) &&
+      GST_VIDEO_INFO_HEIGHT (&info) == GST_VIDEO_INFO_HEIGHT (wanted) &&
+      GST_VIDEO_INFO_FPS_N (&info) * GST_VIDEO_INFO_FPS_D (wanted) ==
+      GST_VIDEO_INFO_FPS_N (wanted) * GST_VIDEO_INFO_FPS_D (&info))
+    g_clear_pointer (&best, gst_caps_unref);
+
+  return best;
+}
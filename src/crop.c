@@ -0,0 +1,235 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <gst/video/video.h>
+
+#include "crop.h"
+
+/* Crops without touching the pixels: the cropped buffer shares the
+ * memory of the original and only carries a GstVideoMeta whose plane
+ * offsets point at the top left corner of the rectangle, with the
+ * original strides. Whatever maps the frame downstream, such as the
+ * videoscale of the output, reads the rectangle only. Not thread-safe;
+ * the relay serialises calls with its pushes. */
+
+struct _Crop
+{
+  /* Requested rectangle, width and height 0 for the whole frame, and
+   * zoom into its centre. */
+  gint          x;
+  gint          y;
+  gint          width;
+  gint          height;
+  gdouble       zoom;
+
+  /* Derived from the caps of the last frame. */
+  gboolean      dirty;
+  GstCaps      *caps;
+  GstVideoInfo  info;
+  gboolean      supported;
+  gint          crop_x;
+  gint          crop_y;
+  gint          crop_width;
+  gint          crop_height;
+  GstCaps      *cropped_caps;
+};
+
+Crop*
+crop_new (gint    x,
+          gint    y,
+          gint    width,
+          gint    height,
+          gdouble zoom)
+{
+  Crop *crop;
+
+  crop = g_new0 (Crop, 1);
+  crop->x = MAX (x, 0);
+  crop->y = MAX (y, 0);
+  crop->width = MAX (width, 0);
+  crop->height = MAX (height, 0);
+  crop->zoom = MAX (zoom, 1.0);
+  crop->dirty = TRUE;
+
+  return crop;
+}
+
+Crop*
+crop_copy (Crop *crop)
+{
+  return crop_new (crop->x, crop->y, crop->width, crop->height, crop->zoom);
+}
+
+void
+crop_free (Crop *crop)
+{
+  if (crop->caps != NULL)
+    gst_caps_unref (crop->caps);
+  if (crop->cropped_caps != NULL)
+    gst_caps_unref (crop->cropped_caps);
+  g_free (crop);
+}
+
+gboolean
+crop_equal (Crop *crop,
+            Crop *other)
+{
+  return crop->x == other->x && crop->y == other->y &&
+      crop->width == other->width && crop->height == other->height &&
+      crop->zoom == other->zoom;
+}
+
+/* Takes the rectangle and zoom of @other from the next frame on. */
+void
+crop_update (Crop *crop,
+             Crop *other)
+{
+  crop->x = other->x;
+  crop->y = other->y;
+  crop->width = other->width;
+  crop->height = other->height;
+  crop->zoom = other->zoom;
+  crop->dirty = TRUE;
+}
+
+/* Clamps the rectangle to the frame, zooms into it and rounds it to
+ * whole chroma samples. */
+static void
+crop_prepare (Crop    *crop,
+              GstCaps *caps)
+{
+  const GstVideoFormatInfo *finfo;
+  gint frame_width, frame_height, width, height;
+  guint comp, w_sub = 0, h_sub = 0;
+
+  gst_caps_replace (&crop->caps, caps);
+  g_clear_pointer (&crop->cropped_caps, gst_caps_unref);
+  crop->dirty = FALSE;
+
+  crop->supported = gst_video_info_from_caps (&crop->info, caps);
+  finfo = crop->info.finfo;
+  if (crop->supported)
+    crop->supported =
+        GST_VIDEO_FORMAT_INFO_FORMAT (finfo) != GST_VIDEO_FORMAT_ENCODED &&
+        !GST_VIDEO_FORMAT_INFO_IS_TILED (finfo) &&
+        !GST_VIDEO_FORMAT_INFO_HAS_PALETTE (finfo);
+  if (!crop->supported) {
+    GST_WARNING ("Cannot crop %" GST_PTR_FORMAT, caps);
+    crop->cropped_caps = gst_caps_ref (caps);
+    return;
+  }
+
+  for (comp = 0; comp < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); comp++) {
+    w_sub = MAX (w_sub, GST_VIDEO_FORMAT_INFO_W_SUB (finfo, comp));
+    h_sub = MAX (h_sub, GST_VIDEO_FORMAT_INFO_H_SUB (finfo, comp));
+  }
+
+  frame_width = GST_VIDEO_INFO_WIDTH (&crop->info);
+  frame_height = GST_VIDEO_INFO_HEIGHT (&crop->info);
+  crop->crop_x = MIN (crop->x, frame_width - 1);
+  crop->crop_y = MIN (crop->y, frame_height - 1);
+  width = frame_width - crop->crop_x;
+  if (crop->width > 0)
+    width = MIN (width, crop->width);
+  height = frame_height - crop->crop_y;
+  if (crop->height > 0)
+    height = MIN (height, crop->height);
+
+  crop->crop_width = width / crop->zoom;
+  crop->crop_height = height / crop->zoom;
+  crop->crop_x += (width - crop->crop_width) / 2;
+  crop->crop_y += (height - crop->crop_height) / 2;
+
+  crop->crop_x &= ~((1 << w_sub) - 1);
+  crop->crop_y &= ~((1 << h_sub) - 1);
+  crop->crop_width = MAX (crop->crop_width & ~((1 << w_sub) - 1),
+                          1 << w_sub);
+  crop->crop_height = MAX (crop->crop_height & ~((1 << h_sub) - 1),
+                           1 << h_sub);
+
+  crop->cropped_caps = gst_caps_copy (caps);
+  gst_caps_set_simple (crop->cropped_caps,
+                       "width", G_TYPE_INT, crop->crop_width,
+                       "height", G_TYPE_INT, crop->crop_height,
+                       NULL);
+  GST_DEBUG ("Cropping %dx%d to %dx%d at %d,%d",
+             frame_width, frame_height, crop->crop_width, crop->crop_height,
+             crop->crop_x, crop->crop_y);
+}
+
+/* Returns a new reference to a buffer showing the rectangle of
+ * @buffer, described by @caps. @cropped_caps is set to the caps of the
+ * result, valid until the next call. Formats that cannot be cropped by
+ * offsets are passed through. */
+GstBuffer*
+crop_buffer (Crop       *crop,
+             GstCaps    *caps,
+             GstBuffer  *buffer,
+             GstCaps   **cropped_caps)
+{
+  const GstVideoFormatInfo *finfo;
+  gsize offsets[GST_VIDEO_MAX_PLANES];
+  gint strides[GST_VIDEO_MAX_PLANES];
+  gboolean offset_set[GST_VIDEO_MAX_PLANES] = { FALSE, };
+  GstVideoMeta *meta;
+  GstBuffer *cropped;
+  guint plane, comp;
+
+  if (crop->dirty || crop->caps == NULL ||
+      (caps != crop->caps && !gst_caps_is_equal (caps, crop->caps)))
+    crop_prepare (crop, caps);
+
+  *cropped_caps = crop->cropped_caps;
+  if (!crop->supported)
+    return gst_buffer_ref (buffer);
+
+  finfo = crop->info.finfo;
+  meta = gst_buffer_get_video_meta (buffer);
+  for (plane = 0; plane < GST_VIDEO_INFO_N_PLANES (&crop->info); plane++) {
+    offsets[plane] = meta != NULL ? meta->offset[plane] :
+        GST_VIDEO_INFO_PLANE_OFFSET (&crop->info, plane);
+    strides[plane] = meta != NULL ? meta->stride[plane] :
+        GST_VIDEO_INFO_PLANE_STRIDE (&crop->info, plane);
+  }
+
+  /* Components sharing a plane share its subsampling and pixel stride,
+   * so the first one locates the rectangle in it. */
+  for (comp = 0; comp < GST_VIDEO_FORMAT_INFO_N_COMPONENTS (finfo); comp++) {
+    plane = GST_VIDEO_FORMAT_INFO_PLANE (finfo, comp);
+    if (offset_set[plane])
+      continue;
+    offsets[plane] +=
+        GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp, crop->crop_y) *
+        strides[plane] +
+        GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, crop->crop_x) *
+        GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+    offset_set[plane] = TRUE;
+  }
+
+  cropped = gst_buffer_copy_region (buffer,
+                                    GST_BUFFER_COPY_FLAGS |
+                                    GST_BUFFER_COPY_TIMESTAMPS |
+                                    GST_BUFFER_COPY_MEMORY, 0, -1);
+  gst_buffer_add_video_meta_full (cropped, GST_VIDEO_FRAME_FLAG_NONE,
+                                  GST_VIDEO_INFO_FORMAT (&crop->info),
+                                  crop->crop_width, crop->crop_height,
+                                  GST_VIDEO_INFO_N_PLANES (&crop->info),
+                                  offsets, strides);
+
+  return cropped;
+}
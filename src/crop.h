@@ -0,0 +1,42 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_CROP_H__
+#define __RELAY_CROP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Crop Crop;
+
+Crop*      crop_new    (gint       x,
+                        gint       y,
+                        gint       width,
+                        gint       height,
+                        gdouble    zoom);
+Crop*      crop_copy   (Crop      *crop);
+void       crop_free   (Crop      *crop);
+gboolean   crop_equal  (Crop      *crop,
+                        Crop      *other);
+void       crop_update (Crop      *crop,
+                        Crop      *other);
+GstBuffer* crop_buffer (Crop      *crop,
+                        GstCaps   *caps,
+                        GstBuffer *buffer,
+                        GstCaps  **cropped_caps);
+
+G_END_DECLS
+
+#endif /* __RELAY_CROP_H__ */
@@ -0,0 +1,336 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include "decoder.h"
+
+/* Decodes JPEG frames on a pool of worker pipelines, each with its own
+ * streaming thread, so that a frame is decoded while the next ones are.
+ * A frame only goes to a worker that is idle: when all of them are
+ * busy it is dropped rather than queued, as by the time a worker was
+ * free a newer frame would be waiting anyway. Frames arriving faster
+ * than the output takes them are skipped before decoding. Workers
+ * finish in any order; a frame older than the last one delivered is
+ * late and dropped, so the output never goes back in time, and nothing
+ * ever waits for a frame the decoder could not decode. A worker that
+ * skipped a broken frame is idle again at once, and one whose pipeline
+ * failed on it is restarted before it gets the next one. */
+
+#define DECODER_DESCRIPTION \
+  "appsrc name=appsrc ! jpegdec ! videoconvert ! videoscale ! " \
+  "appsink name=appsink"
+
+/* A worker without a result after this long has lost its frame. */
+#define DECODER_STUCK_TIME G_USEC_PER_SEC
+
+typedef struct
+{
+  Decoder    *decoder;
+  GstElement *pipeline;
+  GstElement *appsrc;
+  /* Only touched by the thread pushing frames. */
+  GstCaps    *caps;
+  /* When the frame being decoded was pushed, 0 when idle. */
+  gint64      busy_since;
+  /* Whether the pipeline stopped on an error. */
+  gboolean    failed;
+} DecoderWorker;
+
+struct _Decoder
+{
+  GPtrArray        *workers;
+  DecoderFrameFunc  func;
+  gpointer          user_data;
+  /* Smallest distance between the frames decoded, or 0. */
+  GstClockTime      interval;
+
+  /* Protects the workers' busy_since and the fields below. */
+  GMutex            lock;
+  guint             next;
+  GstClockTime      last_pushed;
+  /* Serialises delivery, and protects last_delivered. */
+  GMutex            deliver_lock;
+  GstClockTime      last_delivered;
+
+  gint              decoded;
+  gint              skipped;
+  gint              dropped;
+  gint              late;
+  gint              errors;
+};
+
+static GstBusSyncReply
+decoder_bus_sync_handler (GstBus     *bus,
+                          GstMessage *msg,
+                          gpointer    data)
+{
+  DecoderWorker *worker = (DecoderWorker *) data;
+  GError *error = NULL;
+
+  /* Below its max-errors, jpegdec drops a broken frame with a warning
+   * and goes on, so the worker is idle again right away. */
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_WARNING) {
+    gst_message_parse_warning (msg, &error, NULL);
+    GST_DEBUG ("Frame not decoded: %s", error->message);
+    g_error_free (error);
+
+    g_mutex_lock (&worker->decoder->lock);
+    worker->busy_since = 0;
+    g_mutex_unlock (&worker->decoder->lock);
+    g_atomic_int_inc (&worker->decoder->errors);
+  } else if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error (msg, &error, NULL);
+    GST_WARNING ("Decoding failed: %s", error->message);
+    g_error_free (error);
+
+    g_mutex_lock (&worker->decoder->lock);
+    worker->busy_since = 0;
+    worker->failed = TRUE;
+    g_mutex_unlock (&worker->decoder->lock);
+    g_atomic_int_inc (&worker->decoder->errors);
+  }
+
+  return GST_BUS_DROP;
+}
+
+static GstFlowReturn
+decoder_worker_new_sample (GstAppSink *appsink,
+                           gpointer    user_data)
+{
+  DecoderWorker *worker = (DecoderWorker *) user_data;
+  Decoder *decoder = worker->decoder;
+  GstClockTime pts;
+  GstSample *sample;
+
+  sample = gst_app_sink_pull_sample (appsink);
+  pts = GST_BUFFER_PTS (gst_sample_get_buffer (sample));
+
+  g_mutex_lock (&decoder->lock);
+  worker->busy_since = 0;
+  g_mutex_unlock (&decoder->lock);
+
+  g_mutex_lock (&decoder->deliver_lock);
+  if (GST_CLOCK_TIME_IS_VALID (pts) &&
+      GST_CLOCK_TIME_IS_VALID (decoder->last_delivered) &&
+      pts <= decoder->last_delivered)
+    g_atomic_int_inc (&decoder->late);
+  else {
+    decoder->last_delivered = pts;
+    g_atomic_int_inc (&decoder->decoded);
+    decoder->func (sample, decoder->user_data);
+  }
+  g_mutex_unlock (&decoder->deliver_lock);
+
+  gst_sample_unref (sample);
+
+  return GST_FLOW_OK;
+}
+
+static void
+decoder_worker_free (DecoderWorker *worker)
+{
+  gst_element_set_state (worker->pipeline, GST_STATE_NULL);
+  gst_object_unref (worker->appsrc);
+  gst_object_unref (worker->pipeline);
+  g_clear_pointer (&worker->caps, gst_caps_unref);
+  g_free (worker);
+}
+
+static DecoderWorker*
+decoder_worker_new (Decoder  *decoder,
+                    GstCaps  *caps,
+                    GError  **error)
+{
+  DecoderWorker *worker;
+  GstElement *appsink;
+  GstBus *bus;
+
+  worker = g_new0 (DecoderWorker, 1);
+  worker->decoder = decoder;
+  worker->pipeline = gst_parse_launch (DECODER_DESCRIPTION, error);
+  if (worker->pipeline == NULL) {
+    g_free (worker);
+    return NULL;
+  }
+  gst_object_ref_sink (worker->pipeline);
+
+  worker->appsrc = gst_bin_get_by_name (GST_BIN (worker->pipeline), "appsrc");
+  g_object_set (worker->appsrc,
+                "stream-type", GST_APP_STREAM_TYPE_STREAM,
+                "format", GST_FORMAT_TIME,
+                "emit-signals", FALSE,
+                NULL);
+
+  appsink = gst_bin_get_by_name (GST_BIN (worker->pipeline), "appsink");
+  g_object_set (appsink,
+                "caps", caps,
+                "sync", FALSE,
+                "emit-signals", TRUE,
+                NULL);
+  g_signal_connect (appsink,
+                    "new-sample", (GCallback) decoder_worker_new_sample,
+                    worker);
+  gst_object_unref (appsink);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (worker->pipeline));
+  gst_bus_set_sync_handler (bus, decoder_bus_sync_handler, worker, NULL);
+  gst_object_unref (bus);
+
+  if (gst_element_set_state (worker->pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    g_set_error (error, GST_CORE_ERROR, GST_CORE_ERROR_STATE_CHANGE,
+                 "could not start a decoder");
+    decoder_worker_free (worker);
+    return NULL;
+  }
+
+  return worker;
+}
+
+/* Decodes to @caps on @n_workers threads, handing every frame to @func,
+ * and no more frames than the framerate of @caps asks for. */
+Decoder*
+decoder_new (guint              n_workers,
+             GstCaps           *caps,
+             DecoderFrameFunc   func,
+             gpointer           user_data,
+             GError           **error)
+{
+  Decoder *decoder;
+  gint fps_n, fps_d;
+  guint i;
+
+  decoder = g_new0 (Decoder, 1);
+  decoder->func = func;
+  decoder->user_data = user_data;
+  decoder->last_pushed = GST_CLOCK_TIME_NONE;
+  decoder->last_delivered = GST_CLOCK_TIME_NONE;
+  g_mutex_init (&decoder->lock);
+  g_mutex_init (&decoder->deliver_lock);
+
+  if (!gst_caps_is_empty (caps) &&
+      gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+                                  "framerate", &fps_n, &fps_d) && fps_n > 0)
+    decoder->interval = gst_util_uint64_scale_int (GST_SECOND, fps_d, fps_n);
+
+  decoder->workers =
+      g_ptr_array_new_with_free_func ((GDestroyNotify) decoder_worker_free);
+  for (i = 0; i < n_workers; i++) {
+    DecoderWorker *worker = decoder_worker_new (decoder, caps, error);
+
+    if (worker == NULL) {
+      decoder_free (decoder);
+      return NULL;
+    }
+    g_ptr_array_add (decoder->workers, worker);
+  }
+
+  return decoder;
+}
+
+/* Stops the workers, waiting for the frames they are delivering. */
+void
+decoder_free (Decoder *decoder)
+{
+  g_ptr_array_free (decoder->workers, TRUE);
+  g_mutex_clear (&decoder->lock);
+  g_mutex_clear (&decoder->deliver_lock);
+  g_free (decoder);
+}
+
+/* Hands the JPEG frame of @sample to an idle worker, unless it comes
+ * too soon after the previous one or all workers are busy. Called from
+ * one thread at a time. */
+void
+decoder_push (Decoder   *decoder,
+              GstSample *sample)
+{
+  GstBuffer *buffer = gst_sample_get_buffer (sample);
+  GstCaps *caps = gst_sample_get_caps (sample);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  DecoderWorker *worker = NULL;
+  gboolean failed;
+  gint64 now;
+  guint i;
+
+  g_mutex_lock (&decoder->lock);
+
+  /* Allow some jitter, a quarter of a frame, in the timestamps. */
+  if (decoder->interval > 0 && GST_CLOCK_TIME_IS_VALID (pts) &&
+      GST_CLOCK_TIME_IS_VALID (decoder->last_pushed) &&
+      pts < decoder->last_pushed + decoder->interval * 3 / 4) {
+    g_mutex_unlock (&decoder->lock);
+    g_atomic_int_inc (&decoder->skipped);
+    return;
+  }
+
+  now = g_get_monotonic_time ();
+  for (i = 0; i < decoder->workers->len; i++) {
+    DecoderWorker *candidate =
+        g_ptr_array_index (decoder->workers,
+                           (decoder->next + i) % decoder->workers->len);
+
+    if (candidate->busy_since == 0 ||
+        now - candidate->busy_since > DECODER_STUCK_TIME) {
+      worker = candidate;
+      break;
+    }
+  }
+  if (worker == NULL) {
+    g_mutex_unlock (&decoder->lock);
+    g_atomic_int_inc (&decoder->dropped);
+    return;
+  }
+  worker->busy_since = now;
+  decoder->next = (decoder->next + i + 1) % decoder->workers->len;
+  decoder->last_pushed = pts;
+  failed = worker->failed;
+  worker->failed = FALSE;
+
+  g_mutex_unlock (&decoder->lock);
+
+  /* Restarted here, as the streaming thread that hit the error cannot
+   * stop its own pipeline. */
+  if (failed) {
+    GST_DEBUG ("Restarting a failed decoder");
+    gst_element_set_state (worker->pipeline, GST_STATE_NULL);
+    gst_element_set_state (worker->pipeline, GST_STATE_PLAYING);
+    g_clear_pointer (&worker->caps, gst_caps_unref);
+  }
+
+  if (caps != NULL && (worker->caps == NULL ||
+                       !gst_caps_is_equal (caps, worker->caps))) {
+    gst_caps_replace (&worker->caps, caps);
+    gst_app_src_set_caps (GST_APP_SRC (worker->appsrc), caps);
+  }
+  gst_app_src_push_buffer (GST_APP_SRC (worker->appsrc),
+                           gst_buffer_ref (buffer));
+}
+
+void
+decoder_get_stats (Decoder      *decoder,
+                   DecoderStats *stats)
+{
+  stats->decoded = (guint) g_atomic_int_get (&decoder->decoded);
+  stats->skipped = (guint) g_atomic_int_get (&decoder->skipped);
+  stats->dropped = (guint) g_atomic_int_get (&decoder->dropped);
+  stats->late = (guint) g_atomic_int_get (&decoder->late);
+  stats->errors = (guint) g_atomic_int_get (&decoder->errors);
+}
@@ -0,0 +1,50 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_DECODER_H__
+#define __RELAY_DECODER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Decoder Decoder;
+
+/* Called on a worker thread with every decoded frame, in order. */
+typedef void (*DecoderFrameFunc) (GstSample *sample,
+                                  gpointer   user_data);
+
+typedef struct
+{
+  guint decoded;
+  guint skipped;
+  guint dropped;
+  guint late;
+  guint errors;
+} DecoderStats;
+
+Decoder* decoder_new       (guint              n_workers,
+                            GstCaps           *caps,
+                            DecoderFrameFunc   func,
+                            gpointer           user_data,
+                            GError           **error);
+void     decoder_free      (Decoder           *decoder);
+void     decoder_push      (Decoder           *decoder,
+                            GstSample         *sample);
+void     decoder_get_stats (Decoder           *decoder,
+                            DecoderStats      *stats);
+
+G_END_DECLS
+
+#endif /* __RELAY_DECODER_H__ */
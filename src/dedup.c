@@ -0,0 +1,267 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/video/video.h>
+
+#if defined (__x86_64__)
+#include <nmmintrin.h>
+#define DEDUP_HAVE_SSE42 1
+#elif defined (__aarch64__) && defined (__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define DEDUP_HAVE_ARM_CRC32 1
+#endif
+
+#include "dedup.h"
+
+/* Tells frames with the same content as the previous one apart by a
+ * 64-bit hash of every step-th row of each plane, two CRC32C lanes over
+ * alternating 8 byte words where the CPU has a CRC32C instruction. Only
+ * the visible bytes of a row are hashed, never its padding. Encoded
+ * frames are hashed whole. Rows left out by a step above 1 may change
+ * unnoticed, so no frame is taken for a duplicate more than
+ * DEDUP_MAX_REPEATS times in a row. */
+
+#define DEDUP_MAX_REPEATS 30
+
+typedef guint64 (*HashFunc) (guint64       hash,
+                             const guint8 *data,
+                             gsize         size);
+
+struct _Dedup
+{
+  guint        step;
+
+  GstCaps     *caps;
+  GstVideoInfo info;
+  gboolean     raw;
+
+  guint64      hash;
+  gboolean     hash_valid;
+  guint        repeats;
+};
+
+static HashFunc hash_update = NULL;
+
+#define HASH_PRIME G_GUINT64_CONSTANT (0x9e3779b97f4a7c15)
+
+static guint64
+hash_update_c (guint64       hash,
+               const guint8 *data,
+               gsize         size)
+{
+  guint64 word;
+  gsize i;
+
+  for (i = 0; i + 8 <= size; i += 8) {
+    memcpy (&word, data + i, 8);
+    hash = ((hash << 27 | hash >> 37) ^ word) * HASH_PRIME;
+  }
+  for (; i < size; i++)
+    hash = ((hash << 27 | hash >> 37) ^ data[i]) * HASH_PRIME;
+
+  return hash;
+}
+
+#if defined (DEDUP_HAVE_SSE42)
+__attribute__ ((target ("sse4.2")))
+static guint64
+hash_update_sse42 (guint64       hash,
+                   const guint8 *data,
+                   gsize         size)
+{
+  guint64 a = hash >> 32, b = hash & 0xffffffff, w0, w1;
+  gsize i;
+
+  for (i = 0; i + 16 <= size; i += 16) {
+    memcpy (&w0, data + i, 8);
+    memcpy (&w1, data + i + 8, 8);
+    a = _mm_crc32_u64 (a, w0);
+    b = _mm_crc32_u64 (b, w1);
+  }
+  for (; i < size; i++)
+    a = _mm_crc32_u8 ((guint32) a, data[i]);
+
+  return a << 32 | b;
+}
+#endif
+
+#if defined (DEDUP_HAVE_ARM_CRC32)
+static guint64
+hash_update_arm (guint64       hash,
+                 const guint8 *data,
+                 gsize         size)
+{
+  guint32 a = hash >> 32, b = hash & 0xffffffff;
+  guint64 w0, w1;
+  gsize i;
+
+  for (i = 0; i + 16 <= size; i += 16) {
+    memcpy (&w0, data + i, 8);
+    memcpy (&w1, data + i + 8, 8);
+    a = __crc32cd (a, w0);
+    b = __crc32cd (b, w1);
+  }
+  for (; i < size; i++)
+    a = __crc32cb (a, data[i]);
+
+  return (guint64) a << 32 | b;
+}
+#endif
+
+static void
+dedup_init_once ()
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  hash_update = hash_update_c;
+#if defined (DEDUP_HAVE_SSE42)
+  if (__builtin_cpu_supports ("sse4.2"))
+    hash_update = hash_update_sse42;
+#elif defined (DEDUP_HAVE_ARM_CRC32)
+  hash_update = hash_update_arm;
+#endif
+
+  g_once_init_leave (&initialized, 1);
+}
+
+/* Hashes every @step-th row of each plane, 1 hashing all of them. */
+Dedup*
+dedup_new (guint step)
+{
+  Dedup *dedup;
+
+  dedup_init_once ();
+
+  dedup = g_new0 (Dedup, 1);
+  dedup->step = MAX (step, 1);
+
+  return dedup;
+}
+
+void
+dedup_free (Dedup *dedup)
+{
+  g_clear_pointer (&dedup->caps, gst_caps_unref);
+  g_free (dedup);
+}
+
+guint
+dedup_get_step (Dedup *dedup)
+{
+  return dedup->step;
+}
+
+void
+dedup_set_step (Dedup *dedup,
+                guint  step)
+{
+  dedup->step = MAX (step, 1);
+  dedup->hash_valid = FALSE;
+}
+
+/* Forgets the previous frame, so that the next one is never a repeat. */
+void
+dedup_reset (Dedup *dedup)
+{
+  dedup->hash_valid = FALSE;
+  dedup->repeats = 0;
+}
+
+static gboolean
+dedup_hash (Dedup     *dedup,
+            GstBuffer *buffer,
+            guint64   *hash)
+{
+  const GstVideoFormatInfo *finfo = dedup->info.finfo;
+  GstVideoFrame frame;
+  GstMapInfo map;
+  guint plane, comp, y;
+
+  *hash = 0;
+
+  if (!dedup->raw) {
+    if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+      return FALSE;
+    *hash = hash_update (*hash, map.data, map.size);
+    gst_buffer_unmap (buffer, &map);
+    return TRUE;
+  }
+
+  if (GST_VIDEO_FORMAT_INFO_IS_TILED (finfo) ||
+      GST_VIDEO_FORMAT_INFO_HAS_PALETTE (finfo) ||
+      !gst_video_frame_map (&frame, &dedup->info, buffer, GST_MAP_READ))
+    return FALSE;
+
+  for (plane = 0; plane < GST_VIDEO_FRAME_N_PLANES (&frame); plane++) {
+    const guint8 *data = GST_VIDEO_FRAME_PLANE_DATA (&frame, plane);
+    gint stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, plane);
+    guint width, height, row_size;
+
+    for (comp = 0; GST_VIDEO_FORMAT_INFO_PLANE (finfo, comp) != plane; comp++)
+      ;
+    width = GST_VIDEO_FRAME_WIDTH (&frame);
+    height = GST_VIDEO_FRAME_HEIGHT (&frame);
+    width = GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp, width);
+    height = GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp, height);
+    row_size = width * GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp);
+
+    for (y = 0; y < height; y += dedup->step)
+      *hash = hash_update (*hash, data + (gsize) y * stride, row_size);
+  }
+
+  gst_video_frame_unmap (&frame);
+
+  return TRUE;
+}
+
+/* Returns TRUE if @buffer, described by @caps, looks the same as the
+ * buffer of the previous call. */
+gboolean
+dedup_check (Dedup     *dedup,
+             GstCaps   *caps,
+             GstBuffer *buffer)
+{
+  gboolean same;
+  guint64 hash;
+
+  if (dedup->caps == NULL ||
+      (caps != dedup->caps && !gst_caps_is_equal (caps, dedup->caps))) {
+    gst_caps_replace (&dedup->caps, caps);
+    dedup->raw = gst_video_info_from_caps (&dedup->info, caps) &&
+        GST_VIDEO_INFO_FORMAT (&dedup->info) != GST_VIDEO_FORMAT_ENCODED;
+    dedup->hash_valid = FALSE;
+  }
+
+  if (!dedup_hash (dedup, buffer, &hash)) {
+    dedup->hash_valid = FALSE;
+    return FALSE;
+  }
+
+  same = dedup->hash_valid && hash == dedup->hash &&
+      dedup->repeats < DEDUP_MAX_REPEATS;
+  dedup->repeats = same ? dedup->repeats + 1 : 0;
+  dedup->hash = hash;
+  dedup->hash_valid = TRUE;
+
+  return same;
+}
@@ -0,0 +1,36 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_DEDUP_H__
+#define __RELAY_DEDUP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Dedup Dedup;
+
+Dedup*   dedup_new      (guint      step);
+void     dedup_free     (Dedup     *dedup);
+guint    dedup_get_step (Dedup     *dedup);
+void     dedup_set_step (Dedup     *dedup,
+                         guint      step);
+void     dedup_reset    (Dedup     *dedup);
+gboolean dedup_check    (Dedup     *dedup,
+                         GstCaps   *caps,
+                         GstBuffer *buffer);
+
+G_END_DECLS
+
+#endif /* __RELAY_DEDUP_H__ */
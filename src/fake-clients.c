@@ -0,0 +1,169 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "fake-clients.h"
+
+/* Stands in for the client usage events of a v4l2loopback device. Every
+ * relay reads client counts from a FIFO named after it, one per line,
+ * optionally followed by the monotonic time in microseconds at which the
+ * count was sent:
+ *
+ *   echo 1 > DIR/default      a client opened the device
+ *   echo 0 > DIR/default      the last client closed it
+ *
+ * Lines are far shorter than PIPE_BUF, so concurrent writers never
+ * interleave them. */
+
+#define FAKE_CLIENTS_LINE_MAX 64
+
+static gchar*
+fake_clients_path (const gchar *dir,
+                   const gchar *name)
+{
+  gchar *base, *path;
+
+  /* Relay names may contain anything a key file group does. */
+  base = g_strdelimit (g_strdup (name), "/", '_');
+  path = g_build_filename (dir, base, NULL);
+  g_free (base);
+
+  return path;
+}
+
+/* Creates the FIFO of relay @name in @dir and returns its read end. */
+gint
+fake_clients_open (const gchar  *dir,
+                   const gchar  *name,
+                   GError      **error)
+{
+  gchar *path;
+  gint fd;
+
+  path = fake_clients_path (dir, name);
+  if (mkfifo (path, 0600) < 0 && errno != EEXIST) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not create %s: %s", path, g_strerror (saved_errno));
+    g_free (path);
+    return -1;
+  }
+
+  /* Holding a write end as well keeps the FIFO from reporting end of
+   * file each time an injector closes it. */
+  fd = open (path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not open %s: %s", path, g_strerror (saved_errno));
+  }
+  g_free (path);
+
+  return fd;
+}
+
+/* Drains every pending line like VIDIOC_DQEVENT drains pending events,
+ * keeping the last count. @sent_at is 0 when the sender gave no time.
+ * Returns FALSE if no complete line was pending. */
+gboolean
+fake_clients_read (gint    fd,
+                   guint  *clients,
+                   gint64 *sent_at)
+{
+  gchar buffer[FAKE_CLIENTS_LINE_MAX * 64];
+  gboolean have_usage = FALSE;
+  gsize length = 0;
+  gssize size;
+
+  while ((size = read (fd, buffer + length,
+                       sizeof (buffer) - 1 - length)) > 0) {
+    gchar *line, *end;
+
+    length += size;
+    buffer[length] = '\0';
+
+    for (line = buffer; (end = strchr (line, '\n')) != NULL; line = end + 1) {
+      guint count;
+      gint64 time = 0;
+
+      *end = '\0';
+      if (sscanf (line, "%u %" G_GINT64_FORMAT, &count, &time) < 1)
+        continue;
+
+      *clients = count;
+      *sent_at = time;
+      have_usage = TRUE;
+    }
+
+    length = strlen (line);
+    memmove (buffer, line, length + 1);
+  }
+
+  return have_usage;
+}
+
+/* Returns a write end of the FIFO of relay @name in @dir. */
+gint
+fake_clients_connect (const gchar  *dir,
+                      const gchar  *name,
+                      GError      **error)
+{
+  gchar *path;
+  gint fd;
+
+  path = fake_clients_path (dir, name);
+  fd = open (path, O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not open %s: %s", path, g_strerror (saved_errno));
+  }
+  g_free (path);
+
+  return fd;
+}
+
+gboolean
+fake_clients_send (gint      fd,
+                   guint     clients,
+                   GError  **error)
+{
+  gchar line[FAKE_CLIENTS_LINE_MAX];
+  gint length;
+
+  length = g_snprintf (line, sizeof (line), "%u %" G_GINT64_FORMAT "\n",
+                       clients, g_get_monotonic_time ());
+  if (write (fd, line, length) != length) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not send client count: %s", g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
@@ -0,0 +1,37 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_FAKE_CLIENTS_H__
+#define __RELAY_FAKE_CLIENTS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+gint     fake_clients_open    (const gchar  *dir,
+                               const gchar  *name,
+                               GError      **error);
+gboolean fake_clients_read    (gint          fd,
+                               guint        *clients,
+                               gint64       *sent_at);
+gint     fake_clients_connect (const gchar  *dir,
+                               const gchar  *name,
+                               GError      **error);
+gboolean fake_clients_send    (gint          fd,
+                               guint         clients,
+                               GError      **error);
+
+G_END_DECLS
+
+#endif /* __RELAY_FAKE_CLIENTS_H__ */
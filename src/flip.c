@@ -0,0 +1,586 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <string.h>
+
+#include <gst/video/video.h>
+
+#if defined (__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined (__x86_64__) || defined (__i386__)
+#include <tmmintrin.h>
+#define FLIP_HAVE_SSSE3 1
+#elif defined (__aarch64__)
+#include <arm_neon.h>
+#define FLIP_HAVE_NEON 1
+#endif
+
+#include "flip.h"
+
+/* Mirrors and rotates frames into buffers of a pool, one pass over the
+ * pixels. A mirrored row is the source row read backwards in 16 byte
+ * blocks, each reversed with a single byte shuffle. A quarter turn is a
+ * transpose of the source read from its last row up (90) or its last
+ * column back (270), done in tiles that stay in the cache, each made
+ * of 16x16 byte or 8x8 16-bit blocks transposed in registers. Packed
+ * 4:2:2 frames keep the order of their chroma bytes when mirrored, and
+ * average the two chroma samples a rotated pair of pixels comes from.
+ * Not thread-safe; the relay serialises calls with its pushes. */
+
+/* Side of a transpose tile in elements: 64 rows of 64 bytes stay in L1. */
+#define FLIP_TILE 64
+
+typedef void (*MirrorFunc) (guint8       *dst,
+                            const guint8 *src,
+                            guint         n,
+                            guint         unit,
+                            const guint8 *perm);
+
+struct _Flip
+{
+  FlipMethod    method;
+
+  /* Derived from the caps of the last frame. */
+  GstCaps      *caps;
+  GstVideoInfo  info;
+  gboolean      supported;
+  gboolean      packed;
+  GstCaps      *flipped_caps;
+  GstVideoInfo  flipped_info;
+  GstBufferPool *pool;
+};
+
+static const guint8 identity_perm[4] = { 0, 1, 2, 3 };
+static MirrorFunc mirror_row = NULL;
+
+gboolean
+flip_method_from_string (const gchar *string,
+                         FlipMethod  *method)
+{
+  static const gchar *names[] = {
+    "none", "horizontal", "90", "180", "270"
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (names); i++) {
+    if (g_str_equal (string, names[i])) {
+      *method = (FlipMethod) i;
+      return TRUE;
+    }
+  }
+
+  return FALSE;
+}
+
+/* Copies the @n units of @unit bytes of @src to @dst in reverse order,
+ * reordering the bytes within each unit as @perm says. */
+static void
+mirror_row_c (guint8       *dst,
+              const guint8 *src,
+              guint         n,
+              guint         unit,
+              const guint8 *perm)
+{
+  guint i, j;
+
+  for (i = 0; i < n; i++) {
+    const guint8 *s = src + (n - 1 - i) * unit;
+
+    for (j = 0; j < unit; j++)
+      dst[i * unit + j] = s[perm[j]];
+  }
+}
+
+#if defined (FLIP_HAVE_SSSE3) || defined (FLIP_HAVE_NEON)
+/* Shuffle reversing the units of a 16 byte block. */
+static void
+mirror_mask (guint8       *mask,
+             guint         unit,
+             const guint8 *perm)
+{
+  guint b;
+
+  for (b = 0; b < 16; b++)
+    mask[b] = (16 / unit - 1 - b / unit) * unit + perm[b % unit];
+}
+#endif
+
+#if defined (FLIP_HAVE_SSSE3)
+__attribute__ ((target ("ssse3")))
+static void
+mirror_row_ssse3 (guint8       *dst,
+                  const guint8 *src,
+                  guint         n,
+                  guint         unit,
+                  const guint8 *perm)
+{
+  guint per_block = 16 / unit, i;
+  guint8 m[16];
+  __m128i mask;
+
+  mirror_mask (m, unit, perm);
+  mask = _mm_loadu_si128 ((const __m128i *) m);
+  for (i = 0; i + per_block <= n; i += per_block) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *)
+                                 (src + (n - i - per_block) * unit));
+
+    _mm_storeu_si128 ((__m128i *) (dst + i * unit),
+                      _mm_shuffle_epi8 (v, mask));
+  }
+  mirror_row_c (dst + i * unit, src, n - i, unit, perm);
+}
+#endif
+
+#if defined (FLIP_HAVE_NEON)
+static void
+mirror_row_neon (guint8       *dst,
+                 const guint8 *src,
+                 guint         n,
+                 guint         unit,
+                 const guint8 *perm)
+{
+  guint per_block = 16 / unit, i;
+  guint8 m[16];
+  uint8x16_t mask;
+
+  mirror_mask (m, unit, perm);
+  mask = vld1q_u8 (m);
+  for (i = 0; i + per_block <= n; i += per_block)
+    vst1q_u8 (dst + i * unit,
+              vqtbl1q_u8 (vld1q_u8 (src + (n - i - per_block) * unit), mask));
+  mirror_row_c (dst + i * unit, src, n - i, unit, perm);
+}
+#endif
+
+/* Writes dst[j][i] = S(i, j) for i < @rows and j < @cols, S(i, j) being
+ * the element at @src + i * @src_stride + j * @col_step. */
+static void
+transpose_c (guint8       *dst,
+             gint          dst_stride,
+             const guint8 *src,
+             gint          src_stride,
+             gint          col_step,
+             guint         rows,
+             guint         cols,
+             guint         unit)
+{
+  guint i, j;
+
+  for (j = 0; j < cols; j++) {
+    guint8 *d = dst + j * dst_stride;
+    const guint8 *s = src + (gint) j * col_step;
+
+    if (unit == 1) {
+      for (i = 0; i < rows; i++)
+        d[i] = s[(gint) i * src_stride];
+    } else {
+      for (i = 0; i < rows; i++)
+        memcpy (d + i * unit, s + (gint) i * src_stride, unit);
+    }
+  }
+}
+
+#if defined (__SSE2__)
+/* Transposes a block of 16x16 bytes, or of 8x8 16-bit units, by
+ * interleaving the first half of the rows with the second, four or
+ * three times over. With a negative @col_step the source columns are
+ * loaded in ascending address order and the rows written backwards. */
+static void
+transpose_block_sse2 (guint8       *dst,
+                      gint          dst_stride,
+                      const guint8 *src,
+                      gint          src_stride,
+                      gint          col_step,
+                      guint         unit)
+{
+  guint n = 16 / unit, half = n / 2, stage, k;
+  __m128i r[16], t[16];
+
+  if (col_step < 0)
+    src += (gint) (n - 1) * col_step;
+
+  for (k = 0; k < n; k++)
+    r[k] = _mm_loadu_si128 ((const __m128i *) (src + (gint) k * src_stride));
+
+  for (stage = 0; stage < (unit == 1 ? 4 : 3); stage++) {
+    for (k = 0; k < half; k++) {
+      if (unit == 1) {
+        t[2 * k] = _mm_unpacklo_epi8 (r[k], r[k + half]);
+        t[2 * k + 1] = _mm_unpackhi_epi8 (r[k], r[k + half]);
+      } else {
+        t[2 * k] = _mm_unpacklo_epi16 (r[k], r[k + half]);
+        t[2 * k + 1] = _mm_unpackhi_epi16 (r[k], r[k + half]);
+      }
+    }
+    memcpy (r, t, n * sizeof (__m128i));
+  }
+
+  for (k = 0; k < n; k++)
+    _mm_storeu_si128 ((__m128i *) (dst + (col_step < 0 ? n - 1 - k : k) *
+                                   dst_stride), r[k]);
+}
+#endif
+
+static void
+transpose_plane (guint8       *dst,
+                 gint          dst_stride,
+                 const guint8 *src,
+                 gint          src_stride,
+                 gint          col_step,
+                 guint         rows,
+                 guint         cols,
+                 guint         unit)
+{
+  guint block = 16 / unit, i0, j0, i, j;
+
+  for (i0 = 0; i0 < rows; i0 += FLIP_TILE) {
+    for (j0 = 0; j0 < cols; j0 += FLIP_TILE) {
+      guint i_end = MIN (i0 + FLIP_TILE, rows);
+      guint j_end = MIN (j0 + FLIP_TILE, cols);
+
+      for (i = i0; i < i_end; i += block) {
+        for (j = j0; j < j_end; j += block) {
+          guint8 *d = dst + j * dst_stride + i * unit;
+          const guint8 *s = src + (gint) i * src_stride + (gint) j * col_step;
+
+#if defined (__SSE2__)
+          if (i + block <= i_end && j + block <= j_end) {
+            transpose_block_sse2 (d, dst_stride, s, src_stride, col_step,
+                                  unit);
+            continue;
+          }
+#endif
+          transpose_c (d, dst_stride, s, src_stride, col_step,
+                       MIN (block, i_end - i), MIN (block, j_end - j), unit);
+        }
+      }
+    }
+  }
+}
+
+/* Flips a plane of @width by @height units of @unit bytes. */
+static void
+flip_plane (FlipMethod    method,
+            guint8       *dst,
+            gint          dst_stride,
+            const guint8 *src,
+            gint          src_stride,
+            guint         width,
+            guint         height,
+            guint         unit,
+            const guint8 *perm)
+{
+  guint y;
+
+  switch (method) {
+    case FLIP_HORIZONTAL:
+      for (y = 0; y < height; y++)
+        mirror_row (dst + y * dst_stride, src + y * src_stride, width, unit,
+                    perm);
+      break;
+    case FLIP_ROTATE_180:
+      for (y = 0; y < height; y++)
+        mirror_row (dst + y * dst_stride,
+                    src + (height - 1 - y) * src_stride, width, unit, perm);
+      break;
+    case FLIP_ROTATE_90:
+      transpose_plane (dst, dst_stride, src + (height - 1) * src_stride,
+                       -src_stride, unit, height, width, unit);
+      break;
+    case FLIP_ROTATE_270:
+      transpose_plane (dst, dst_stride, src + (width - 1) * unit,
+                       src_stride, -(gint) unit, height, width, unit);
+      break;
+    default:
+      break;
+  }
+}
+
+/* Rotates a packed 4:2:2 frame of @width by @height pixels a quarter
+ * turn. Every output macropixel takes its two luma samples from two
+ * neighbouring source rows, and the average of their chroma. */
+static void
+rotate_packed (FlipMethod    method,
+               guint8       *dst,
+               gint          dst_stride,
+               const guint8 *src,
+               gint          src_stride,
+               guint         width,
+               guint         height,
+               const guint8 *luma,
+               const guint8 *chroma)
+{
+  guint y0, m0, y, m;
+
+  for (y0 = 0; y0 < width; y0 += FLIP_TILE) {
+    for (m0 = 0; m0 < height / 2; m0 += FLIP_TILE / 2) {
+      for (y = y0; y < MIN (y0 + FLIP_TILE, width); y++) {
+        guint x = method == FLIP_ROTATE_90 ? y : width - 1 - y;
+        guint byte = (x / 2) * 4;
+        guint8 *d = dst + y * dst_stride;
+
+        for (m = m0; m < MIN (m0 + FLIP_TILE / 2, height / 2); m++) {
+          const guint8 *s0, *s1;
+
+          if (method == FLIP_ROTATE_90) {
+            s0 = src + (height - 1 - 2 * m) * src_stride + byte;
+            s1 = s0 - src_stride;
+          } else {
+            s0 = src + 2 * m * src_stride + byte;
+            s1 = s0 + src_stride;
+          }
+
+          d[m * 4 + luma[0]] = s0[luma[x & 1]];
+          d[m * 4 + luma[1]] = s1[luma[x & 1]];
+          d[m * 4 + chroma[0]] = (s0[chroma[0]] + s1[chroma[0]] + 1) >> 1;
+          d[m * 4 + chroma[1]] = (s0[chroma[1]] + s1[chroma[1]] + 1) >> 1;
+        }
+      }
+    }
+  }
+}
+
+static void
+flip_init_once ()
+{
+  static gsize initialized = 0;
+
+  if (!g_once_init_enter (&initialized))
+    return;
+
+  mirror_row = mirror_row_c;
+#if defined (FLIP_HAVE_SSSE3)
+  if (__builtin_cpu_supports ("ssse3"))
+    mirror_row = mirror_row_ssse3;
+#elif defined (FLIP_HAVE_NEON)
+  mirror_row = mirror_row_neon;
+#endif
+
+  g_once_init_leave (&initialized, 1);
+}
+
+Flip*
+flip_new (FlipMethod method)
+{
+  Flip *flip;
+
+  flip_init_once ();
+
+  flip = g_new0 (Flip, 1);
+  flip->method = method;
+
+  return flip;
+}
+
+static void
+flip_clear (Flip *flip)
+{
+  if (flip->pool != NULL) {
+    gst_buffer_pool_set_active (flip->pool, FALSE);
+    gst_object_unref (flip->pool);
+    flip->pool = NULL;
+  }
+  g_clear_pointer (&flip->caps, gst_caps_unref);
+  g_clear_pointer (&flip->flipped_caps, gst_caps_unref);
+}
+
+void
+flip_free (Flip *flip)
+{
+  flip_clear (flip);
+  g_free (flip);
+}
+
+FlipMethod
+flip_get_method (Flip *flip)
+{
+  return flip->method;
+}
+
+static void
+flip_prepare (Flip    *flip,
+              GstCaps *caps)
+{
+  GstStructure *structure;
+  GstStructure *config;
+  gint par_n, par_d;
+
+  flip_clear (flip);
+  flip->caps = gst_caps_ref (caps);
+  flip->supported = FALSE;
+
+  if (gst_video_info_from_caps (&flip->info, caps)) {
+    switch (GST_VIDEO_INFO_FORMAT (&flip->info)) {
+      case GST_VIDEO_FORMAT_NV12:
+      case GST_VIDEO_FORMAT_NV21:
+      case GST_VIDEO_FORMAT_I420:
+      case GST_VIDEO_FORMAT_YV12:
+      case GST_VIDEO_FORMAT_GRAY8:
+        flip->packed = FALSE;
+        flip->supported = TRUE;
+        break;
+      case GST_VIDEO_FORMAT_YUY2:
+      case GST_VIDEO_FORMAT_YVYU:
+      case GST_VIDEO_FORMAT_UYVY:
+        flip->packed = TRUE;
+        /* Macropixels must not be split, nor pairs of rows when rotating. */
+        flip->supported = GST_VIDEO_INFO_WIDTH (&flip->info) % 2 == 0 &&
+            (!FLIP_METHOD_IS_ROTATION (flip->method) ||
+             GST_VIDEO_INFO_HEIGHT (&flip->info) % 2 == 0);
+        break;
+      default:
+        break;
+    }
+  }
+  if (!flip->supported) {
+    GST_WARNING ("Cannot flip %" GST_PTR_FORMAT, caps);
+    flip->flipped_caps = gst_caps_ref (caps);
+    return;
+  }
+
+  flip->flipped_caps = gst_caps_copy (caps);
+  if (FLIP_METHOD_IS_ROTATION (flip->method)) {
+    structure = gst_caps_get_structure (flip->flipped_caps, 0);
+    gst_structure_set (structure,
+                       "width", G_TYPE_INT, GST_VIDEO_INFO_HEIGHT (&flip->info),
+                       "height", G_TYPE_INT, GST_VIDEO_INFO_WIDTH (&flip->info),
+                       NULL);
+    if (gst_structure_get_fraction (structure, "pixel-aspect-ratio",
+                                    &par_n, &par_d))
+      gst_structure_set (structure, "pixel-aspect-ratio", GST_TYPE_FRACTION,
+                         par_d, par_n, NULL);
+  }
+  gst_video_info_from_caps (&flip->flipped_info, flip->flipped_caps);
+
+  flip->pool = gst_buffer_pool_new ();
+  config = gst_buffer_pool_get_config (flip->pool);
+  gst_buffer_pool_config_set_params (config, flip->flipped_caps,
+                                     GST_VIDEO_INFO_SIZE (&flip->flipped_info),
+                                     2, 0);
+  if (!gst_buffer_pool_set_config (flip->pool, config) ||
+      !gst_buffer_pool_set_active (flip->pool, TRUE)) {
+    GST_WARNING ("Cannot allocate flipped frames");
+    gst_object_unref (flip->pool);
+    flip->pool = NULL;
+    flip->supported = FALSE;
+    gst_caps_replace (&flip->flipped_caps, caps);
+  }
+}
+
+static void
+flip_frame (Flip         *flip,
+            GstVideoFrame *out,
+            GstVideoFrame *in)
+{
+  const GstVideoFormatInfo *finfo = flip->info.finfo;
+  guint plane, comp;
+
+  if (flip->packed) {
+    /* Luma bytes first, then chroma, within a macropixel. */
+    static const guint8 yuy2[4] = { 0, 2, 1, 3 };
+    static const guint8 uyvy[4] = { 1, 3, 0, 2 };
+    static const guint8 yuy2_perm[4] = { 2, 1, 0, 3 };
+    static const guint8 uyvy_perm[4] = { 0, 3, 2, 1 };
+    gboolean is_uyvy =
+        GST_VIDEO_INFO_FORMAT (&flip->info) == GST_VIDEO_FORMAT_UYVY;
+    const guint8 *order = is_uyvy ? uyvy : yuy2;
+
+    if (FLIP_METHOD_IS_ROTATION (flip->method))
+      rotate_packed (flip->method,
+                     GST_VIDEO_FRAME_PLANE_DATA (out, 0),
+                     GST_VIDEO_FRAME_PLANE_STRIDE (out, 0),
+                     GST_VIDEO_FRAME_PLANE_DATA (in, 0),
+                     GST_VIDEO_FRAME_PLANE_STRIDE (in, 0),
+                     GST_VIDEO_FRAME_WIDTH (in), GST_VIDEO_FRAME_HEIGHT (in),
+                     order, order + 2);
+    else
+      flip_plane (flip->method,
+                  GST_VIDEO_FRAME_PLANE_DATA (out, 0),
+                  GST_VIDEO_FRAME_PLANE_STRIDE (out, 0),
+                  GST_VIDEO_FRAME_PLANE_DATA (in, 0),
+                  GST_VIDEO_FRAME_PLANE_STRIDE (in, 0),
+                  GST_VIDEO_FRAME_WIDTH (in) / 2, GST_VIDEO_FRAME_HEIGHT (in),
+                  4, is_uyvy ? uyvy_perm : yuy2_perm);
+    return;
+  }
+
+  /* The first component of a plane gives its size and pixel stride,
+   * the only interleaved one being the 16-bit chroma of NV12/NV21. */
+  for (plane = 0; plane < GST_VIDEO_INFO_N_PLANES (&flip->info); plane++) {
+    for (comp = 0; GST_VIDEO_FORMAT_INFO_PLANE (finfo, comp) != plane; comp++)
+      ;
+    flip_plane (flip->method,
+                GST_VIDEO_FRAME_PLANE_DATA (out, plane),
+                GST_VIDEO_FRAME_PLANE_STRIDE (out, plane),
+                GST_VIDEO_FRAME_PLANE_DATA (in, plane),
+                GST_VIDEO_FRAME_PLANE_STRIDE (in, plane),
+                GST_VIDEO_FORMAT_INFO_SCALE_WIDTH (finfo, comp,
+                                                   GST_VIDEO_FRAME_WIDTH (in)),
+                GST_VIDEO_FORMAT_INFO_SCALE_HEIGHT (finfo, comp,
+                                                    GST_VIDEO_FRAME_HEIGHT (in)),
+                GST_VIDEO_FORMAT_INFO_PSTRIDE (finfo, comp), identity_perm);
+  }
+}
+
+/* Returns a new reference to a flipped copy of @buffer, described by
+ * @caps, and sets @flipped_caps to its caps, valid until the next call.
+ * Frames that cannot be flipped are passed through. */
+GstBuffer*
+flip_buffer (Flip       *flip,
+             GstCaps    *caps,
+             GstBuffer  *buffer,
+             GstCaps   **flipped_caps)
+{
+  GstVideoFrame in, out;
+  GstBuffer *flipped = NULL;
+
+  if (flip->caps == NULL ||
+      (caps != flip->caps && !gst_caps_is_equal (caps, flip->caps)))
+    flip_prepare (flip, caps);
+
+  *flipped_caps = flip->flipped_caps;
+  if (!flip->supported)
+    return gst_buffer_ref (buffer);
+
+  if (gst_buffer_pool_acquire_buffer (flip->pool, &flipped, NULL) !=
+      GST_FLOW_OK)
+    goto passthrough;
+  if (!gst_video_frame_map (&in, &flip->info, buffer, GST_MAP_READ)) {
+    gst_buffer_unref (flipped);
+    goto passthrough;
+  }
+  if (!gst_video_frame_map (&out, &flip->flipped_info, flipped,
+                            GST_MAP_WRITE)) {
+    gst_video_frame_unmap (&in);
+    gst_buffer_unref (flipped);
+    goto passthrough;
+  }
+
+  flip_frame (flip, &out, &in);
+
+  gst_video_frame_unmap (&out);
+  gst_video_frame_unmap (&in);
+  gst_buffer_copy_into (flipped, buffer, GST_BUFFER_COPY_TIMESTAMPS, 0, -1);
+
+  return flipped;
+
+passthrough:
+  *flipped_caps = caps;
+  return gst_buffer_ref (buffer);
+}
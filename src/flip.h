@@ -0,0 +1,49 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_FLIP_H__
+#define __RELAY_FLIP_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  FLIP_NONE,
+  FLIP_HORIZONTAL,
+  FLIP_ROTATE_90,
+  FLIP_ROTATE_180,
+  FLIP_ROTATE_270,
+} FlipMethod;
+
+/* Rotations by a quarter turn exchange width and height. */
+#define FLIP_METHOD_IS_ROTATION(method) \
+  ((method) == FLIP_ROTATE_90 || (method) == FLIP_ROTATE_270)
+
+typedef struct _Flip Flip;
+
+gboolean   flip_method_from_string (const gchar  *string,
+                                    FlipMethod   *method);
+Flip*      flip_new                (FlipMethod    method);
+void       flip_free               (Flip         *flip);
+FlipMethod flip_get_method         (Flip         *flip);
+GstBuffer* flip_buffer             (Flip         *flip,
+                                    GstCaps      *caps,
+                                    GstBuffer    *buffer,
+                                    GstCaps     **flipped_caps);
+
+G_END_DECLS
+
+#endif /* __RELAY_FLIP_H__ */
@@ -0,0 +1,169 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <unistd.h>
+
+#include <gio/gunixfdmessage.h>
+#include <gio/gunixsocketaddress.h>
+
+#include "handover.h"
+
+/* The handover protocol exchanges one line of text per SOCK_SEQPACKET
+ * message, optionally carrying a single file descriptor:
+ *
+ *   new daemon                      old daemon
+ *   HANDOVER            ---->
+ *                       <----       RELAY <clients> <name>   + event fd
+ *                       <----       ...
+ *                       <----       END
+ *   RELEASE             ---->
+ *                       <----       RELEASED
+ */
+
+#define HANDOVER_LINE_MAX 512
+
+GSocket*
+handover_listen (const gchar  *path,
+                 GError      **error)
+{
+  GSocketAddress *address;
+  GSocket *socket;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_SEQPACKET,
+                         G_SOCKET_PROTOCOL_DEFAULT, error);
+  if (socket == NULL)
+    return NULL;
+
+  unlink (path);
+  address = g_unix_socket_address_new (path);
+  if (!g_socket_bind (socket, address, TRUE, error) ||
+      !g_socket_listen (socket, error)) {
+    g_object_unref (address);
+    g_object_unref (socket);
+    return NULL;
+  }
+  g_object_unref (address);
+
+  return socket;
+}
+
+GSocket*
+handover_connect (const gchar  *path,
+                  GError      **error)
+{
+  GSocketAddress *address;
+  GSocket *socket;
+
+  socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_SEQPACKET,
+                         G_SOCKET_PROTOCOL_DEFAULT, error);
+  if (socket == NULL)
+    return NULL;
+
+  address = g_unix_socket_address_new (path);
+  if (!g_socket_connect (socket, address, NULL, error)) {
+    g_object_unref (address);
+    g_object_unref (socket);
+    return NULL;
+  }
+  g_object_unref (address);
+  g_socket_set_timeout (socket, HANDOVER_TIMEOUT);
+
+  return socket;
+}
+
+gboolean
+handover_send (GSocket      *socket,
+               const gchar  *line,
+               gint          fd,
+               GError      **error)
+{
+  GSocketControlMessage *message = NULL;
+  GOutputVector vector;
+  gssize sent;
+
+  vector.buffer = line;
+  vector.size = strlen (line);
+
+  if (fd >= 0) {
+    message = g_unix_fd_message_new ();
+    if (!g_unix_fd_message_append_fd (G_UNIX_FD_MESSAGE (message),
+                                      fd, error)) {
+      g_object_unref (message);
+      return FALSE;
+    }
+  }
+
+  sent = g_socket_send_message (socket, NULL, &vector, 1,
+                                message != NULL ? &message : NULL,
+                                message != NULL ? 1 : 0,
+                                0, NULL, error);
+  if (message != NULL)
+    g_object_unref (message);
+
+  return sent >= 0;
+}
+
+/* Returns the next line sent by the peer, and its file descriptor in @fd,
+ * or -1 if the message carried none. */
+gchar*
+handover_receive (GSocket  *socket,
+                  gint     *fd,
+                  GError  **error)
+{
+  GSocketControlMessage **messages = NULL;
+  gchar buffer[HANDOVER_LINE_MAX];
+  GInputVector vector;
+  gint n_messages = 0, i;
+  gssize received;
+
+  *fd = -1;
+
+  vector.buffer = buffer;
+  vector.size = sizeof (buffer) - 1;
+  received = g_socket_receive_message (socket, NULL, &vector, 1,
+                                       &messages, &n_messages,
+                                       NULL, NULL, error);
+  if (received < 0)
+    return NULL;
+  if (received == 0) {
+    g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                         "peer closed the handover connection");
+    return NULL;
+  }
+
+  for (i = 0; i < n_messages; i++) {
+    if (G_IS_UNIX_FD_MESSAGE (messages[i])) {
+      gint *fds, n_fds, j;
+
+      fds = g_unix_fd_message_steal_fds (G_UNIX_FD_MESSAGE (messages[i]),
+                                         &n_fds);
+      for (j = 0; j < n_fds; j++) {
+        if (*fd < 0)
+          *fd = fds[j];
+        else
+          close (fds[j]);
+      }
+      g_free (fds);
+    }
+    g_object_unref (messages[i]);
+  }
+  g_free (messages);
+
+  buffer[received] = '\0';
+  return g_strdup (buffer);
+}
@@ -0,0 +1,239 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <gio/gio.h>
+
+#include "loopback.h"
+
+/* From linux/v4l2loopback.h, which is not installed along with the
+ * module. Negative or zero fields select the module defaults. */
+struct v4l2_loopback_config
+{
+  gint32  output_nr;
+  gint32  unused;
+  gchar   card_label[32];
+  guint32 min_width;
+  guint32 max_width;
+  guint32 min_height;
+  guint32 max_height;
+  gint32  max_buffers;
+  gint32  max_openers;
+  gint32  debug;
+  gint32  announce_all_caps;
+};
+
+#define V4L2LOOPBACK_CTL_ADD    0x4C80
+#define V4L2LOOPBACK_CTL_REMOVE 0x4C81
+
+/* The fake hands out device numbers from here on. */
+#define LOOPBACK_FAKE_FIRST_DEVICE 100
+
+typedef struct
+{
+  LoopbackControl parent;
+  gint            fd;
+} LoopbackControlDevice;
+
+typedef struct
+{
+  LoopbackControl parent;
+  GHashTable     *devices;
+  gint            next_nr;
+} LoopbackControlFake;
+
+static gint
+loopback_control_device_add (LoopbackControl  *control,
+                             const gchar      *label,
+                             guint             width,
+                             guint             height,
+                             GError          **error)
+{
+  LoopbackControlDevice *self = (LoopbackControlDevice *) control;
+  struct v4l2_loopback_config config;
+  gint device_nr;
+
+  memset (&config, 0, sizeof (config));
+  config.output_nr = -1;
+  config.unused = -1;
+  g_strlcpy (config.card_label, label, sizeof (config.card_label));
+  config.max_width = width;
+  config.max_height = height;
+  config.max_buffers = -1;
+  config.max_openers = -1;
+  config.debug = -1;
+  /* Same as exclusive_caps=1 in the module configuration. */
+  config.announce_all_caps = 0;
+
+  device_nr = ioctl (self->fd, V4L2LOOPBACK_CTL_ADD, &config);
+  if (device_nr < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Could not add loopback device '%s': %s",
+                 label, g_strerror (saved_errno));
+    return -1;
+  }
+
+  return device_nr;
+}
+
+static gboolean
+loopback_control_device_remove (LoopbackControl  *control,
+                                gint              device_nr,
+                                GError          **error)
+{
+  LoopbackControlDevice *self = (LoopbackControlDevice *) control;
+
+  if (ioctl (self->fd, V4L2LOOPBACK_CTL_REMOVE, device_nr) < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                 "Could not remove /dev/video%d: %s",
+                 device_nr, g_strerror (saved_errno));
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+loopback_control_device_free (LoopbackControl *control)
+{
+  LoopbackControlDevice *self = (LoopbackControlDevice *) control;
+
+  close (self->fd);
+  g_free (self);
+}
+
+LoopbackControl*
+loopback_control_open (const gchar  *path,
+                       GError      **error)
+{
+  LoopbackControlDevice *self;
+  gint fd;
+
+  fd = open (path, O_RDWR | O_CLOEXEC);
+  if (fd < 0) {
+    int saved_errno = errno;
+
+    g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                 "Could not open %s: %s", path, g_strerror (saved_errno));
+    return NULL;
+  }
+
+  self = g_new0 (LoopbackControlDevice, 1);
+  self->parent.add = loopback_control_device_add;
+  self->parent.remove = loopback_control_device_remove;
+  self->parent.free = loopback_control_device_free;
+  self->fd = fd;
+
+  return (LoopbackControl *) self;
+}
+
+static gint
+loopback_control_fake_add (LoopbackControl  *control,
+                           const gchar      *label,
+                           guint             width,
+                           guint             height,
+                           GError          **error)
+{
+  LoopbackControlFake *self = (LoopbackControlFake *) control;
+  gint device_nr = self->next_nr++;
+
+  g_hash_table_insert (self->devices, GINT_TO_POINTER (device_nr),
+                       g_strdup_printf ("%s %ux%u", label, width, height));
+
+  return device_nr;
+}
+
+static gboolean
+loopback_control_fake_remove (LoopbackControl  *control,
+                              gint              device_nr,
+                              GError          **error)
+{
+  LoopbackControlFake *self = (LoopbackControlFake *) control;
+
+  if (!g_hash_table_remove (self->devices, GINT_TO_POINTER (device_nr))) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                 "No loopback device %d", device_nr);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static void
+loopback_control_fake_free (LoopbackControl *control)
+{
+  LoopbackControlFake *self = (LoopbackControlFake *) control;
+
+  /* Devices still present here were leaked by the caller. */
+  if (g_hash_table_size (self->devices) > 0)
+    g_warning ("%u fake loopback device(s) were never removed",
+               g_hash_table_size (self->devices));
+  g_hash_table_unref (self->devices);
+  g_free (self);
+}
+
+/* Keeps track of devices in memory only, for exercising the daemon on
+ * machines without the v4l2loopback module. */
+LoopbackControl*
+loopback_control_fake_new (void)
+{
+  LoopbackControlFake *self;
+
+  self = g_new0 (LoopbackControlFake, 1);
+  self->parent.add = loopback_control_fake_add;
+  self->parent.remove = loopback_control_fake_remove;
+  self->parent.free = loopback_control_fake_free;
+  self->devices = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+  self->next_nr = LOOPBACK_FAKE_FIRST_DEVICE;
+
+  return (LoopbackControl *) self;
+}
+
+/* Returns the number N of the new /dev/videoN, or -1 on error. */
+gint
+loopback_control_add (LoopbackControl  *control,
+                      const gchar      *label,
+                      guint             width,
+                      guint             height,
+                      GError          **error)
+{
+  return control->add (control, label, width, height, error);
+}
+
+gboolean
+loopback_control_remove (LoopbackControl  *control,
+                         gint              device_nr,
+                         GError          **error)
+{
+  return control->remove (control, device_nr, error);
+}
+
+void
+loopback_control_free (LoopbackControl *control)
+{
+  control->free (control);
+}
@@ -0,0 +1,57 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_LOOPBACK_H__
+#define __RELAY_LOOPBACK_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#define LOOPBACK_CONTROL_DEVICE "/dev/v4l2loopback"
+
+typedef struct _LoopbackControl LoopbackControl;
+
+/* Creates and removes v4l2loopback devices. Implemented on top of the
+ * control device of the kernel module, or in memory by the fake. */
+struct _LoopbackControl
+{
+  gint     (*add)    (LoopbackControl  *control,
+                      const gchar      *label,
+                      guint             width,
+                      guint             height,
+                      GError          **error);
+  gboolean (*remove) (LoopbackControl  *control,
+                      gint              device_nr,
+                      GError          **error);
+  void     (*free)   (LoopbackControl  *control);
+};
+
+LoopbackControl* loopback_control_open     (const gchar      *path,
+                                            GError          **error);
+LoopbackControl* loopback_control_fake_new (void);
+
+gint             loopback_control_add      (LoopbackControl  *control,
+                                            const gchar      *label,
+                                            guint             width,
+                                            guint             height,
+                                            GError          **error);
+gboolean         loopback_control_remove   (LoopbackControl  *control,
+                                            gint              device_nr,
+                                            GError          **error);
+void             loopback_control_free     (LoopbackControl  *control);
+
+G_END_DECLS
+
+#endif /* __RELAY_LOOPBACK_H__ */
@@ -0,0 +1,260 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <gio/gio.h>
+
+#include "perf-counters.h"
+
+/* Every thread opens its own group of counters, which only count while
+ * that thread runs, and reads the whole group with one read(2) at each
+ * stage boundary. Only the per-stage totals are shared. */
+
+#define PERF_N_COUNTERS 5
+
+typedef struct
+{
+  guint32      type;
+  guint64      config;
+  const gchar *name;
+} PerfCounter;
+
+static const PerfCounter perf_counters[PERF_N_COUNTERS] = {
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       "cycles" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     "instructions" },
+  { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     "cache-misses" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      "page-faults" },
+  { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "cswch" },
+};
+
+static const gchar *perf_stage_names[PERF_N_STAGES] = {
+  "input", "relay", "convert", "output"
+};
+
+typedef struct
+{
+  gint     fds[PERF_N_COUNTERS];
+  /* Position of each counter in a group read, or -1 if unavailable. */
+  gint     index[PERF_N_COUNTERS];
+  gint     leader;
+  guint    n_open;
+  gint     open_errno;
+  guint64  begin[PERF_N_STAGES][PERF_N_COUNTERS];
+  gboolean started[PERF_N_STAGES];
+} PerfThread;
+
+typedef struct
+{
+  guint64 frames;
+  guint64 totals[PERF_N_COUNTERS];
+  guint64 counted[PERF_N_COUNTERS];
+} PerfTotals;
+
+gboolean perf_counters_enabled = FALSE;
+
+static GMutex perf_lock;
+static PerfTotals perf_totals[PERF_N_STAGES];
+
+static void
+perf_thread_free (gpointer data)
+{
+  PerfThread *thread = (PerfThread *) data;
+  guint i;
+
+  for (i = 0; i < PERF_N_COUNTERS; i++)
+    if (thread->fds[i] >= 0)
+      close (thread->fds[i]);
+  g_free (thread);
+}
+
+static GPrivate perf_thread = G_PRIVATE_INIT (perf_thread_free);
+
+/* Counters the hardware or perf_event_paranoid does not allow are left
+ * out rather than failing the whole group. */
+static PerfThread*
+perf_thread_get ()
+{
+  PerfThread *thread = g_private_get (&perf_thread);
+  struct perf_event_attr attr;
+  guint i;
+
+  if (G_LIKELY (thread != NULL))
+    return thread;
+
+  thread = g_new0 (PerfThread, 1);
+  thread->leader = -1;
+  for (i = 0; i < PERF_N_COUNTERS; i++) {
+    memset (&attr, 0, sizeof (attr));
+    attr.size = sizeof (attr);
+    attr.type = perf_counters[i].type;
+    attr.config = perf_counters[i].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = perf_counters[i].type == PERF_TYPE_HARDWARE;
+    attr.exclude_hv = 1;
+
+    thread->fds[i] = syscall (SYS_perf_event_open, &attr, 0, -1,
+                              thread->leader, PERF_FLAG_FD_CLOEXEC);
+    if (thread->fds[i] < 0) {
+      thread->open_errno = errno;
+      thread->index[i] = -1;
+      continue;
+    }
+
+    if (thread->leader < 0)
+      thread->leader = thread->fds[i];
+    thread->index[i] = thread->n_open++;
+  }
+
+  g_private_set (&perf_thread, thread);
+
+  return thread;
+}
+
+static gboolean
+perf_thread_read (PerfThread *thread,
+                  guint64    *values)
+{
+  guint64 group[1 + PERF_N_COUNTERS];
+  gssize size = (1 + thread->n_open) * sizeof (guint64);
+  guint i;
+
+  if (thread->n_open == 0 || read (thread->leader, group, size) != size)
+    return FALSE;
+
+  for (i = 0; i < PERF_N_COUNTERS; i++)
+    values[i] = thread->index[i] >= 0 ? group[1 + thread->index[i]] : 0;
+
+  return TRUE;
+}
+
+static void
+perf_thread_account (PerfThread *thread,
+                     PerfStage   stage,
+                     guint64    *now)
+{
+  PerfTotals *totals = &perf_totals[stage];
+  guint i;
+
+  g_mutex_lock (&perf_lock);
+  totals->frames++;
+  for (i = 0; i < PERF_N_COUNTERS; i++) {
+    if (thread->index[i] < 0)
+      continue;
+    totals->totals[i] += now[i] - thread->begin[stage][i];
+    totals->counted[i]++;
+  }
+  g_mutex_unlock (&perf_lock);
+}
+
+/* Fails if not a single counter can be opened, typically because of
+ * kernel.perf_event_paranoid. */
+gboolean
+perf_counters_init (GError **error)
+{
+  PerfThread *thread = perf_thread_get ();
+
+  if (thread->n_open == 0) {
+    g_set_error (error, G_IO_ERROR, g_io_error_from_errno (thread->open_errno),
+                 "No performance counter available: %s",
+                 g_strerror (thread->open_errno));
+    return FALSE;
+  }
+
+  perf_counters_enabled = TRUE;
+
+  return TRUE;
+}
+
+void
+perf_counters_begin (PerfStage stage)
+{
+  PerfThread *thread = perf_thread_get ();
+
+  thread->started[stage] = perf_thread_read (thread, thread->begin[stage]);
+}
+
+void
+perf_counters_end (PerfStage stage)
+{
+  PerfThread *thread = perf_thread_get ();
+  guint64 now[PERF_N_COUNTERS];
+
+  if (!thread->started[stage])
+    return;
+
+  thread->started[stage] = FALSE;
+  if (perf_thread_read (thread, now))
+    perf_thread_account (thread, stage, now);
+}
+
+/* Ends the stage since the previous lap on this thread and begins the
+ * next one, for stages that loop once per frame. */
+void
+perf_counters_lap (PerfStage stage)
+{
+  PerfThread *thread = perf_thread_get ();
+  guint64 now[PERF_N_COUNTERS];
+
+  if (!perf_thread_read (thread, now))
+    return;
+
+  if (thread->started[stage])
+    perf_thread_account (thread, stage, now);
+  memcpy (thread->begin[stage], now, sizeof (now));
+  thread->started[stage] = TRUE;
+}
+
+void
+perf_counters_print ()
+{
+  guint stage, i;
+
+  g_mutex_lock (&perf_lock);
+  for (stage = 0; stage < PERF_N_STAGES; stage++) {
+    PerfTotals *totals = &perf_totals[stage];
+    GString *line;
+
+    if (totals->frames == 0)
+      continue;
+
+    line = g_string_new (NULL);
+    g_string_append_printf (line, "perf %s: frames=%" G_GUINT64_FORMAT,
+                            perf_stage_names[stage], totals->frames);
+    for (i = 0; i < PERF_N_COUNTERS; i++) {
+      if (totals->counted[i] == 0)
+        g_string_append_printf (line, " %s=n/a", perf_counters[i].name);
+      else
+        g_string_append_printf (line, " %s=%.1f", perf_counters[i].name,
+                                (gdouble) totals->totals[i] /
+                                totals->counted[i]);
+    }
+    if (totals->counted[0] > 0 && totals->totals[0] > 0 &&
+        totals->counted[1] > 0)
+      g_string_append_printf (line, " ipc=%.2f",
+                              (gdouble) totals->totals[1] /
+                              totals->totals[0]);
+    g_message ("%s", line->str);
+    g_string_free (line, TRUE);
+  }
+  g_mutex_unlock (&perf_lock);
+}
@@ -0,0 +1,61 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_PERF_COUNTERS_H__
+#define __RELAY_PERF_COUNTERS_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The stages counted separately. INPUT and OUTPUT cover everything the
+ * input and output streaming threads do between two frames, so INPUT
+ * includes RELAY and OUTPUT includes CONVERT. */
+typedef enum
+{
+  PERF_STAGE_INPUT,
+  PERF_STAGE_RELAY,
+  PERF_STAGE_CONVERT,
+  PERF_STAGE_OUTPUT,
+  PERF_N_STAGES
+} PerfStage;
+
+extern gboolean perf_counters_enabled;
+
+/* Each costs a single branch while counting is disabled. */
+#define PERF_BEGIN(stage)                                              \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (perf_counters_enabled))                             \
+      perf_counters_begin (stage);                                      \
+  } G_STMT_END
+#define PERF_END(stage)                                                \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (perf_counters_enabled))                             \
+      perf_counters_end (stage);                                        \
+  } G_STMT_END
+#define PERF_LAP(stage)                                                \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (perf_counters_enabled))                             \
+      perf_counters_lap (stage);                                        \
+  } G_STMT_END
+
+gboolean perf_counters_init  (GError    **error);
+void     perf_counters_begin (PerfStage   stage);
+void     perf_counters_end   (PerfStage   stage);
+void     perf_counters_lap   (PerfStage   stage);
+void     perf_counters_print (void);
+
+G_END_DECLS
+
+#endif /* __RELAY_PERF_COUNTERS_H__ */
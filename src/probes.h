@@ -0,0 +1,54 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_PROBES_H__
+#define __RELAY_PROBES_H__
+
+#include <glib.h>
+
+/* USDT probes for bpftrace, perf and systemtap. Built with
+ * --enable-usdt, each probe is a single nop until a tracer attaches;
+ * otherwise they compile to nothing. Relay and pipeline names are
+ * passed as C strings, buffer timestamps in nanoseconds and V4L2 event
+ * times in monotonic microseconds. */
+
+#if defined (ENABLE_USDT)
+
+#include <sys/sdt.h>
+
+#define PROBE_FRAME_RECEIVE(relay, pts) \
+  DTRACE_PROBE2 (v4l2_relayd, frame_receive, relay, pts)
+#define PROBE_FRAME_PUSH(relay, pts) \
+  DTRACE_PROBE2 (v4l2_relayd, frame_push, relay, pts)
+#define PROBE_FRAME_DROP(relay, pts, flow) \
+  DTRACE_PROBE3 (v4l2_relayd, frame_drop, relay, pts, flow)
+#define PROBE_STATE_REQUEST(relay, pipeline, state) \
+  DTRACE_PROBE3 (v4l2_relayd, state_request, relay, pipeline, state)
+#define PROBE_STATE_COMPLETE(relay, pipeline, state) \
+  DTRACE_PROBE3 (v4l2_relayd, state_complete, relay, pipeline, state)
+#define PROBE_V4L2_EVENT(relay, clients, time) \
+  DTRACE_PROBE3 (v4l2_relayd, v4l2_event, relay, clients, time)
+
+#else
+
+#define PROBE_FRAME_RECEIVE(relay, pts)              G_STMT_START { } G_STMT_END
+#define PROBE_FRAME_PUSH(relay, pts)                 G_STMT_START { } G_STMT_END
+#define PROBE_FRAME_DROP(relay, pts, flow)           G_STMT_START { } G_STMT_END
+#define PROBE_STATE_REQUEST(relay, pipeline, state)  G_STMT_START { } G_STMT_END
+#define PROBE_STATE_COMPLETE(relay, pipeline, state) G_STMT_START { } G_STMT_END
+#define PROBE_V4L2_EVENT(relay, clients, time)       G_STMT_START { } G_STMT_END
+
+#endif
+
+#endif /* __RELAY_PROBES_H__ */
@@ -0,0 +1,135 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include "recorder.h"
+
+/* The flight recorder keeps the last events of all relays in one ring
+ * shared by all threads. A writer claims a slot with a single atomic add
+ * and marks it complete by storing the claimed sequence number last, so
+ * that the dump can tell complete records from ones being overwritten
+ * without writers ever waiting on each other or on the dump. */
+
+typedef struct
+{
+  gint64       time;
+  const gchar *relay;
+  const gchar *detail;
+  gint64       value;
+  gint         type;
+  /* Claimed sequence number + 1 once the record is complete. */
+  gint         sequence;
+} Record;
+
+static const gchar *record_type_names[] = {
+  [RECORD_FRAME] = "frame",
+  [RECORD_DROP] = "drop",
+  [RECORD_STATE] = "state",
+  [RECORD_CLIENTS] = "clients",
+  [RECORD_ERROR] = "error",
+};
+
+static Record *records = NULL;
+static guint records_mask = 0;
+static gint records_head = 0;
+
+/* Keeps the last @capacity records, rounded up to a power of two. */
+void
+recorder_init (guint capacity)
+{
+  guint size = 1;
+
+  while (size < capacity)
+    size <<= 1;
+
+  records = g_new0 (Record, size);
+  records_mask = size - 1;
+}
+
+/* @relay and @detail must outlive the recorder: use literals or interned
+ * strings. */
+void
+recorder_record (RecordType   type,
+                 const gchar *relay,
+                 const gchar *detail,
+                 gint64       value)
+{
+  guint sequence;
+  Record *record;
+
+  if (G_UNLIKELY (records == NULL))
+    return;
+
+  sequence = (guint) g_atomic_int_add (&records_head, 1);
+  record = &records[sequence & records_mask];
+
+  g_atomic_int_set (&record->sequence, 0);
+  record->time = g_get_monotonic_time ();
+  record->relay = relay;
+  record->detail = detail;
+  record->value = value;
+  record->type = type;
+  g_atomic_int_set (&record->sequence, (gint) (sequence + 1));
+}
+
+/* Writes the records of the last @window microseconds to @path, oldest
+ * first, with times relative to now. */
+gboolean
+recorder_dump (const gchar  *path,
+               gint64        window,
+               const gchar  *reason,
+               GError      **error)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint head, start, i;
+  gboolean written;
+  GString *dump;
+
+  if (records == NULL)
+    return TRUE;
+
+  dump = g_string_new (NULL);
+  g_string_append_printf (dump, "# v4l2-relayd flight recorder: %s\n"
+                          "# ms relay event detail value\n", reason);
+
+  head = (guint) g_atomic_int_get (&records_head);
+  start = head > records_mask + 1 ? head - records_mask - 1 : 0;
+  for (i = start; i < head; i++) {
+    Record *slot = &records[i & records_mask];
+    Record record;
+
+    if ((guint) g_atomic_int_get (&slot->sequence) != i + 1)
+      continue;
+    record = *slot;
+    /* Skip records overwritten while being copied. */
+    if ((guint) g_atomic_int_get (&slot->sequence) != i + 1 ||
+        now - record.time > window)
+      continue;
+
+    g_string_append_printf (dump, "%.3f %s %s %s %" G_GINT64_FORMAT "\n",
+                            (record.time - now) / 1000.0,
+                            record.relay != NULL ? record.relay : "-",
+                            record_type_names[record.type],
+                            record.detail != NULL ? record.detail : "-",
+                            record.value);
+  }
+
+  written = g_file_set_contents (path, dump->str, dump->len, error);
+  g_string_free (dump, TRUE);
+
+  return written;
+}
@@ -0,0 +1,43 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_RECORDER_H__
+#define __RELAY_RECORDER_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum
+{
+  RECORD_FRAME,
+  RECORD_DROP,
+  RECORD_STATE,
+  RECORD_CLIENTS,
+  RECORD_ERROR,
+} RecordType;
+
+void     recorder_init   (guint         capacity);
+void     recorder_record (RecordType    type,
+                          const gchar  *relay,
+                          const gchar  *detail,
+                          gint64        value);
+gboolean recorder_dump   (const gchar  *path,
+                          gint64        window,
+                          const gchar  *reason,
+                          GError      **error);
+
+G_END_DECLS
+
+#endif /* __RELAY_RECORDER_H__ */
@@ -0,0 +1,296 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <sched.h>
+#include <stdlib.h>
+
+#include "task-pool.h"
+
+/* A GstTaskPool shared by every pipeline of the daemon. Streaming tasks
+ * never return while their pipeline is running, so a task that does not
+ * fit cannot be queued behind the others; it runs on a thread of an
+ * unbounded overflow pool instead, pinned the same way, with a warning,
+ * so that the limit never fails a pipeline. Idle threads are kept by
+ * GLib and reused when pipelines are restarted. */
+
+/* Microseconds a push waits for a task that is returning to free its
+ * thread before going to the overflow pool. GstTask lets a restart
+ * through before its function has returned to the pool. */
+#define RELAY_TASK_POOL_RETURN_WAIT 50000
+
+struct _RelayTaskPool
+{
+  GstTaskPool  parent;
+
+  GThreadPool *threads;
+  GstTaskPool *overflow;
+  guint        max_threads;
+  gboolean     pin;
+  cpu_set_t    cpus;
+
+  GMutex       lock;
+  GCond        returned;
+  guint        active;
+  guint        peak;
+};
+
+typedef struct
+{
+  RelayTaskPool      *pool;
+  GstTaskPoolFunction func;
+  gpointer            user_data;
+} RelayTaskPoolJob;
+
+G_DEFINE_TYPE (RelayTaskPool, relay_task_pool, GST_TYPE_TASK_POOL);
+
+/* Runs @job on the calling thread, pinned to the CPUs of its pool. */
+static void
+relay_task_pool_job_run (RelayTaskPoolJob *job)
+{
+  RelayTaskPool *self = job->pool;
+
+  if (self->pin)
+    sched_setaffinity (0, sizeof (self->cpus), &self->cpus);
+
+  job->func (job->user_data);
+  g_free (job);
+}
+
+static void
+relay_task_pool_run (gpointer data,
+                     gpointer user_data)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (user_data);
+
+  relay_task_pool_job_run (data);
+
+  g_mutex_lock (&self->lock);
+  self->active--;
+  g_cond_signal (&self->returned);
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+relay_task_pool_run_overflow (gpointer data)
+{
+  relay_task_pool_job_run (data);
+}
+
+static void
+relay_task_pool_prepare (GstTaskPool  *pool,
+                         GError      **error)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (pool);
+
+  if (self->threads == NULL)
+    self->threads = g_thread_pool_new (relay_task_pool_run, self,
+                                       self->max_threads, FALSE, error);
+  if (self->threads != NULL && self->overflow == NULL) {
+    self->overflow = gst_task_pool_new ();
+    gst_task_pool_prepare (self->overflow, error);
+  }
+}
+
+static void
+relay_task_pool_cleanup (GstTaskPool *pool)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (pool);
+
+  if (self->threads != NULL) {
+    g_thread_pool_free (self->threads, FALSE, TRUE);
+    self->threads = NULL;
+  }
+  if (self->overflow != NULL) {
+    gst_task_pool_cleanup (self->overflow);
+    gst_object_unref (self->overflow);
+    self->overflow = NULL;
+  }
+}
+
+static gpointer
+relay_task_pool_push (GstTaskPool          *pool,
+                      GstTaskPoolFunction   func,
+                      gpointer              user_data,
+                      GError              **error)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (pool);
+  GError *local_error = NULL;
+  RelayTaskPoolJob *job;
+  gint64 deadline;
+  gpointer id;
+
+  job = g_new (RelayTaskPoolJob, 1);
+  job->pool = self;
+  job->func = func;
+  job->user_data = user_data;
+
+  deadline = g_get_monotonic_time () + RELAY_TASK_POOL_RETURN_WAIT;
+  g_mutex_lock (&self->lock);
+  while (self->active >= self->max_threads &&
+         g_cond_wait_until (&self->returned, &self->lock, deadline))
+    ;
+  if (self->active >= self->max_threads) {
+    g_mutex_unlock (&self->lock);
+    GST_WARNING ("All %u streaming threads are busy, starting one more "
+                 "outside the pool", self->max_threads);
+    id = gst_task_pool_push (self->overflow, relay_task_pool_run_overflow,
+                             job, &local_error);
+    if (local_error != NULL) {
+      g_propagate_error (error, local_error);
+      g_free (job);
+    }
+    return id;
+  }
+  self->active++;
+  self->peak = MAX (self->peak, self->active);
+  g_mutex_unlock (&self->lock);
+
+  if (!g_thread_pool_push (self->threads, job, error)) {
+    g_free (job);
+    g_mutex_lock (&self->lock);
+    self->active--;
+    g_mutex_unlock (&self->lock);
+  }
+
+  return NULL;
+}
+
+static void
+relay_task_pool_join (GstTaskPool *pool,
+                      gpointer     id)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (pool);
+
+  /* GstTask waits for its function to return itself; only overflow
+   * tasks may come with an id. */
+  if (id != NULL)
+    gst_task_pool_join (self->overflow, id);
+}
+
+static void
+relay_task_pool_finalize (GObject *object)
+{
+  RelayTaskPool *self = RELAY_TASK_POOL (object);
+
+  relay_task_pool_cleanup (GST_TASK_POOL (self));
+  g_mutex_clear (&self->lock);
+  g_cond_clear (&self->returned);
+
+  G_OBJECT_CLASS (relay_task_pool_parent_class)->finalize (object);
+}
+
+static void
+relay_task_pool_class_init (RelayTaskPoolClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GstTaskPoolClass *pool_class = GST_TASK_POOL_CLASS (klass);
+
+  object_class->finalize = relay_task_pool_finalize;
+
+  pool_class->prepare = relay_task_pool_prepare;
+  pool_class->cleanup = relay_task_pool_cleanup;
+  pool_class->push = relay_task_pool_push;
+  pool_class->join = relay_task_pool_join;
+}
+
+static void
+relay_task_pool_init (RelayTaskPool *self)
+{
+  g_mutex_init (&self->lock);
+  g_cond_init (&self->returned);
+  CPU_ZERO (&self->cpus);
+}
+
+/* Parses a CPU list such as "0-3,6" into @cpus. */
+static gboolean
+parse_cpu_list (const gchar  *list,
+                cpu_set_t    *cpus,
+                GError      **error)
+{
+  gchar **ranges;
+  gsize i;
+
+  CPU_ZERO (cpus);
+
+  ranges = g_strsplit (list, ",", -1);
+  for (i = 0; ranges[i] != NULL; i++) {
+    gchar *end;
+    guint64 first, last;
+
+    first = g_ascii_strtoull (ranges[i], &end, 10);
+    last = first;
+    if (end != ranges[i] && *end == '-')
+      last = g_ascii_strtoull (end + 1, &end, 10);
+
+    if (end == ranges[i] || *end != '\0' || last < first ||
+        last >= CPU_SETSIZE) {
+      g_set_error (error, G_FILE_ERROR, G_FILE_ERROR_INVAL,
+                   "invalid CPU range '%s'", ranges[i]);
+      g_strfreev (ranges);
+      return FALSE;
+    }
+
+    for (; first <= last; first++)
+      CPU_SET (first, cpus);
+  }
+  g_strfreev (ranges);
+
+  return TRUE;
+}
+
+GstTaskPool*
+relay_task_pool_new (guint         max_threads,
+                     const gchar  *cpus,
+                     GError      **error)
+{
+  RelayTaskPool *self;
+
+  g_return_val_if_fail (max_threads > 0, NULL);
+
+  self = g_object_new (RELAY_TYPE_TASK_POOL, NULL);
+  gst_object_ref_sink (self);
+  self->max_threads = max_threads;
+  if (cpus != NULL) {
+    if (!parse_cpu_list (cpus, &self->cpus, error)) {
+      gst_object_unref (self);
+      return NULL;
+    }
+    self->pin = TRUE;
+  }
+
+  gst_task_pool_prepare (GST_TASK_POOL (self), error);
+  if (self->threads == NULL) {
+    gst_object_unref (self);
+    return NULL;
+  }
+
+  return GST_TASK_POOL (self);
+}
+
+void
+relay_task_pool_get_usage (RelayTaskPool *pool,
+                           guint         *active,
+                           guint         *peak,
+                           guint         *max_threads)
+{
+  g_mutex_lock (&pool->lock);
+  *active = pool->active;
+  *peak = pool->peak;
+  *max_threads = pool->max_threads;
+  g_mutex_unlock (&pool->lock);
+}
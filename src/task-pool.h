@@ -0,0 +1,46 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_TASK_POOL_H__
+#define __RELAY_TASK_POOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define RELAY_TYPE_TASK_POOL (relay_task_pool_get_type ())
+#define RELAY_TASK_POOL(obj) \
+    (G_TYPE_CHECK_INSTANCE_CAST ((obj), RELAY_TYPE_TASK_POOL, RelayTaskPool))
+
+typedef struct _RelayTaskPool RelayTaskPool;
+typedef struct _RelayTaskPoolClass RelayTaskPoolClass;
+
+struct _RelayTaskPoolClass
+{
+  GstTaskPoolClass parent_class;
+};
+
+GType        relay_task_pool_get_type   (void);
+
+GstTaskPool* relay_task_pool_new        (guint          max_threads,
+                                         const gchar   *cpus,
+                                         GError       **error);
+void         relay_task_pool_get_usage  (RelayTaskPool *pool,
+                                         guint         *active,
+                                         guint         *peak,
+                                         guint         *max_threads);
+
+G_END_DECLS
+
+#endif /* __RELAY_TASK_POOL_H__ */
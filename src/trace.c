@@ -0,0 +1,228 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+/* Every thread records into a ring of its own, so recording takes no
+ * lock: the owner is the only writer and publishes each event by
+ * advancing the head. Rings of exited threads go back to a free list and
+ * are reused, keeping the memory bounded however many streaming threads
+ * come and go. */
+
+typedef struct
+{
+  gint64       time;
+  const gchar *category;
+  const gchar *name;
+  const gchar *relay;
+  gint64       value;
+  guint32      tid;
+  gchar        phase;
+} TraceEvent;
+
+typedef struct
+{
+  TraceEvent *events;
+  /* Count of events ever recorded, used as an unsigned index. */
+  gint        head;
+  guint32     tid;
+  gboolean    owned;
+} TraceRing;
+
+gboolean trace_enabled = FALSE;
+
+static guint trace_capacity = 0;
+static GMutex trace_lock;
+static GPtrArray *trace_rings = NULL;
+
+static void
+trace_ring_release (gpointer data)
+{
+  TraceRing *ring = (TraceRing *) data;
+
+  g_mutex_lock (&trace_lock);
+  ring->owned = FALSE;
+  g_mutex_unlock (&trace_lock);
+}
+
+static GPrivate trace_ring = G_PRIVATE_INIT (trace_ring_release);
+
+static TraceRing*
+trace_ring_get ()
+{
+  TraceRing *ring = g_private_get (&trace_ring);
+  guint i;
+
+  if (G_LIKELY (ring != NULL))
+    return ring;
+
+  g_mutex_lock (&trace_lock);
+  for (i = 0; i < trace_rings->len; i++) {
+    TraceRing *free_ring = g_ptr_array_index (trace_rings, i);
+
+    if (!free_ring->owned) {
+      ring = free_ring;
+      break;
+    }
+  }
+  if (ring == NULL) {
+    ring = g_new0 (TraceRing, 1);
+    ring->events = g_new0 (TraceEvent, trace_capacity);
+    g_ptr_array_add (trace_rings, ring);
+  }
+  ring->owned = TRUE;
+  ring->tid = (guint32) syscall (SYS_gettid);
+  g_mutex_unlock (&trace_lock);
+
+  g_private_set (&trace_ring, ring);
+
+  return ring;
+}
+
+/* Keeps the last @capacity events of every thread, rounded up to a
+ * power of two. */
+void
+trace_init (guint capacity)
+{
+  trace_capacity = 1;
+  while (trace_capacity < capacity)
+    trace_capacity <<= 1;
+
+  trace_rings = g_ptr_array_new ();
+  trace_enabled = TRUE;
+}
+
+void
+trace_record (const gchar *category,
+              const gchar *name,
+              gchar        phase,
+              const gchar *relay,
+              gint64       value)
+{
+  TraceRing *ring = trace_ring_get ();
+  guint head = (guint) ring->head;
+  TraceEvent *event = &ring->events[head & (trace_capacity - 1)];
+
+  event->time = g_get_monotonic_time ();
+  event->category = category;
+  event->name = name;
+  event->relay = relay;
+  event->value = value;
+  event->tid = ring->tid;
+  event->phase = phase;
+
+  g_atomic_int_set (&ring->head, (gint) (head + 1));
+}
+
+static void
+json_append_string (GString     *json,
+                    const gchar *string)
+{
+  const gchar *c;
+
+  g_string_append_c (json, '"');
+  for (c = string; *c != '\0'; c++) {
+    if (*c == '"' || *c == '\\')
+      g_string_append_printf (json, "\\%c", *c);
+    else if ((guchar) *c < 0x20)
+      g_string_append_printf (json, "\\u%04x", *c);
+    else
+      g_string_append_c (json, *c);
+  }
+  g_string_append_c (json, '"');
+}
+
+/* Copies out the events of @ring that its owner cannot have overwritten
+ * while they were read. */
+static void
+trace_ring_append_json (TraceRing *ring,
+                        GString   *json,
+                        gboolean  *first)
+{
+  TraceEvent *events;
+  guint head, start, count, skip, i;
+
+  head = (guint) g_atomic_int_get (&ring->head);
+  start = head > trace_capacity ? head - trace_capacity : 0;
+  count = head - start;
+  events = g_new (TraceEvent, count);
+  for (i = 0; i < count; i++)
+    events[i] = ring->events[(start + i) & (trace_capacity - 1)];
+
+  /* The slots written since, and the one being written, may be torn. */
+  head = (guint) g_atomic_int_get (&ring->head);
+  skip = head + 1 > start + trace_capacity ?
+      MIN (head + 1 - start - trace_capacity, count) : 0;
+
+  for (i = skip; i < count; i++) {
+    TraceEvent *event = &events[i];
+
+    g_string_append (json, *first ? "\n" : ",\n");
+    *first = FALSE;
+
+    g_string_append (json, "{\"name\":");
+    json_append_string (json, event->name);
+    g_string_append (json, ",\"cat\":");
+    json_append_string (json, event->category);
+    g_string_append_printf (json,
+                            ",\"ph\":\"%c\",\"ts\":%" G_GINT64_FORMAT
+                            ",\"pid\":%d,\"tid\":%u",
+                            event->phase, event->time, (gint) getpid (),
+                            event->tid);
+    if (event->phase == TRACE_INSTANT)
+      g_string_append (json, ",\"s\":\"t\"");
+    g_string_append (json, ",\"args\":{");
+    if (event->relay != NULL) {
+      g_string_append (json, "\"relay\":");
+      json_append_string (json, event->relay);
+      g_string_append_c (json, ',');
+    }
+    g_string_append_printf (json, "\"value\":%" G_GINT64_FORMAT "}}",
+                            event->value);
+  }
+
+  g_free (events);
+}
+
+/* Writes what the rings hold in the Chrome trace event format, which
+ * chrome://tracing and the Perfetto UI both open. */
+gboolean
+trace_write_json (const gchar  *path,
+                  GError      **error)
+{
+  gboolean first = TRUE;
+  gboolean written;
+  GString *json;
+  guint i;
+
+  json = g_string_new ("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  g_mutex_lock (&trace_lock);
+  for (i = 0; i < trace_rings->len; i++)
+    trace_ring_append_json (g_ptr_array_index (trace_rings, i), json, &first);
+  g_mutex_unlock (&trace_lock);
+
+  g_string_append (json, "\n]}\n");
+  written = g_file_set_contents (path, json->str, json->len, error);
+  g_string_free (json, TRUE);
+
+  return written;
+}
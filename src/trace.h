@@ -0,0 +1,49 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_TRACE_H__
+#define __RELAY_TRACE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Chrome trace event phases. */
+#define TRACE_BEGIN   'B'
+#define TRACE_END     'E'
+#define TRACE_INSTANT 'i'
+
+extern gboolean trace_enabled;
+
+/* Records an event in the ring of the calling thread. @category, @name
+ * and @relay must outlive the trace: use literals or interned strings.
+ * Costs a single branch while tracing is disabled. */
+#define TRACE(category, name, phase, relay, value)                     \
+  G_STMT_START {                                                        \
+    if (G_UNLIKELY (trace_enabled))                                     \
+      trace_record ((category), (name), (phase), (relay), (value));     \
+  } G_STMT_END
+
+void     trace_init       (guint         capacity);
+void     trace_record     (const gchar  *category,
+                           const gchar  *name,
+                           gchar         phase,
+                           const gchar  *relay,
+                           gint64        value);
+gboolean trace_write_json (const gchar  *path,
+                           GError      **error);
+
+G_END_DECLS
+
+#endif /* __RELAY_TRACE_H__ */
@@ -0,0 +1,145 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#if defined (HAVE_CONFIG_H)
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <linux/netlink.h>
+
+#include <gio/gunixsocketaddress.h>
+
+#include "uevent.h"
+
+/* Kernel uevents are a "ACTION@DEVPATH" header followed by NUL separated
+ * KEY=VALUE fields, e.g.
+ *
+ *   add@/devices/virtual/video4linux/video10\0ACTION=add\0
+ *   SUBSYSTEM=video4linux\0DEVNAME=video10\0...
+ *
+ * The same datagrams may be sent to a Unix socket instead, so that
+ * hotplug can be exercised without reloading any kernel module. */
+
+#define UEVENT_BUFFER_SIZE 8192
+
+/* Kernel multicast group of NETLINK_KOBJECT_UEVENT. */
+#define UEVENT_GROUP_KERNEL 1
+
+/* Listens for kernel uevents, or for datagrams sent to @path when it is
+ * not NULL. */
+GSocket*
+uevent_open (const gchar  *path,
+             GError      **error)
+{
+  struct sockaddr_nl address = {
+    .nl_family = AF_NETLINK,
+    .nl_groups = UEVENT_GROUP_KERNEL,
+  };
+  GSocket *monitor;
+  gint fd;
+
+  if (path != NULL) {
+    GSocketAddress *unix_address;
+
+    monitor = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_DATAGRAM,
+                            G_SOCKET_PROTOCOL_DEFAULT, error);
+    if (monitor == NULL)
+      return NULL;
+
+    unlink (path);
+    unix_address = g_unix_socket_address_new (path);
+    if (!g_socket_bind (monitor, unix_address, TRUE, error)) {
+      g_object_unref (unix_address);
+      g_object_unref (monitor);
+      return NULL;
+    }
+    g_object_unref (unix_address);
+  } else {
+    fd = socket (AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC,
+                 NETLINK_KOBJECT_UEVENT);
+    if (fd < 0 || bind (fd, (struct sockaddr *) &address,
+                        sizeof (address)) < 0) {
+      int saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Could not listen for uevents: %s",
+                   g_strerror (saved_errno));
+      if (fd >= 0)
+        close (fd);
+      return NULL;
+    }
+
+    monitor = g_socket_new_from_fd (fd, error);
+    if (monitor == NULL) {
+      close (fd);
+      return NULL;
+    }
+  }
+
+  g_socket_set_blocking (monitor, FALSE);
+
+  return monitor;
+}
+
+/* Reads one uevent. @action and @devname are only set for video4linux
+ * events; anything else is consumed and leaves them NULL. */
+gboolean
+uevent_receive (GSocket      *socket,
+                gchar       **action,
+                gchar       **devname,
+                GError      **error)
+{
+  gchar buffer[UEVENT_BUFFER_SIZE];
+  const gchar *event_action = NULL;
+  const gchar *event_devname = NULL;
+  gboolean video4linux = FALSE;
+  gssize size, offset;
+
+  *action = NULL;
+  *devname = NULL;
+
+  size = g_socket_receive (socket, buffer, sizeof (buffer) - 1, NULL, error);
+  if (size < 0)
+    return FALSE;
+  buffer[size] = '\0';
+
+  /* Messages relayed by udevd start with "libudev" rather than a
+   * header holding an '@'; only kernel messages are of interest. */
+  if (strchr (buffer, '@') == NULL)
+    return TRUE;
+
+  for (offset = strlen (buffer) + 1; offset < size;
+       offset += strlen (buffer + offset) + 1) {
+    const gchar *field = buffer + offset;
+
+    if (g_str_has_prefix (field, "ACTION="))
+      event_action = field + strlen ("ACTION=");
+    else if (g_str_has_prefix (field, "DEVNAME="))
+      event_devname = field + strlen ("DEVNAME=");
+    else if (g_strcmp0 (field, "SUBSYSTEM=video4linux") == 0)
+      video4linux = TRUE;
+  }
+
+  if (video4linux && event_action != NULL && event_devname != NULL) {
+    *action = g_strdup (event_action);
+    *devname = g_strdup (event_devname);
+  }
+
+  return TRUE;
+}
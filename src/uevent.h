@@ -0,0 +1,31 @@
+/* v4l2-relayd - V4L2 camera streaming relay daemon
+ * Copyright (C) 2020 Canonical Ltd.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details:
+ */
+
+#ifndef __RELAY_UEVENT_H__
+#define __RELAY_UEVENT_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+GSocket* uevent_open    (const gchar  *path,
+                         GError      **error);
+gboolean uevent_receive (GSocket      *socket,
+                         gchar       **action,
+                         gchar       **devname,
+                         GError      **error);
+
+G_END_DECLS
+
+#endif /* __RELAY_UEVENT_H__ */
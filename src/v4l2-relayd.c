@@ -17,49 +17,285 @@
 #endif
 
 #include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/ioctl.h>
+#include <sys/resource.h>
 #include <linux/videodev2.h>
 
 #include <glib.h>
 #include <glib-unix.h>
 #include <gst/gst.h>
+#include <gst/base/gstbasetransform.h>
 #include <gst/app/gstappsink.h>
 #include <gst/app/gstappsrc.h>
 #include <gst/video/video-info.h>
 
+#include "bench.h"
+#include "camera-mode.h"
+#include "crop.h"
+#include "decoder.h"
+#include "dedup.h"
+#include "fake-clients.h"
+#include "flip.h"
+#include "handover.h"
+#include "loopback.h"
+#include "perf-counters.h"
+#include "probes.h"
+#include "recorder.h"
+#include "task-pool.h"
+#include "trace.h"
+#include "uevent.h"
+
 #define V4L2_EVENT_PRI_CLIENT_USAGE  V4L2_EVENT_PRIVATE_START
 
 struct v4l2_event_client_usage {
   __u32 count;
 };
 
+/* Seconds to wait before restarting a relay whose output pipeline failed
+ * when running multiple relays from a configuration file. */
+#define RELAY_RESTART_DELAY 5
+
+#define RELAY_GROUP_PREFIX "relay "
+#define PROFILE_GROUP_PREFIX "profile "
+#define DAEMON_GROUP "daemon"
+
+/* Where v4l2loopback devices are listed with their card label. */
+#define V4L2_SYSFS_DIR "/sys/devices/virtual/video4linux"
+
+#define DEFAULT_QUEUE_DEPTH 4
+
+/* Flight recorder size: 30 seconds of a few relays at 30 fps and more. */
+#define RECORDER_EVENTS 16384
+
+/* Seconds between flight recorder dumps caused by pipeline errors. */
+#define RECORDER_ERROR_INTERVAL 10
+
+/* Seconds a --bench-run relays live before measuring. */
+#define BENCH_WARMUP 2
+
+/* Microseconds relays get to settle after the last injected event. */
+#define INJECT_SETTLE_TIMEOUT 500000
+
+/* What the first frame after switching between splash and input is
+ * awaited from, to measure the switch latency. */
+enum
+{
+  SWITCH_NONE,
+  SWITCH_TO_INPUT,
+  SWITCH_TO_SPLASH,
+};
+
 GST_DEBUG_CATEGORY_STATIC (gst_debug_category);
 #define GST_CAT_DEFAULT gst_debug_category
 
+typedef struct _Relay Relay;
+
+struct _Relay
+{
+  gchar      *name;
+  /* Outlives the relay in trace events. */
+  const gchar *trace_name;
+  gchar      *input;
+  gchar      *output;
+  gchar      *splash;
+  /* Loopback device the output is bound to when the output description
+   * comes from a profile, resolved each time the relay starts. */
+  gchar      *card_label;
+  gchar      *device;
+  guint       queue_depth;
+  /* Additional loopback devices at other sizes, as "WxH;WxH". */
+  gchar      *extra_sizes;
+  GPtrArray  *extras;
+  /* Threads decoding a JPEG input, or 0 if the input decodes itself. */
+  guint       decode_threads;
+  /* Whether the input streams the camera mode cheapest to bring to the
+   * output, moving the appsrcs to its caps, rather than the output's. */
+  gboolean    cheapest_mode;
+  /* Digital crop and zoom, and mirroring or rotation, of every frame, or
+   * NULL. Only replaced while the pipelines are stopped; transform_lock
+   * serialises their use, and the caps changes they cause on the appsrcs,
+   * with the pushes. */
+  Crop       *crop;
+  Flip       *flip;
+  GMutex      transform_lock;
+  /* Detection of frames repeating the previous one, or NULL, and the
+   * last flipped frame to push again in place of flipping a repeat. */
+  Dedup      *dedup;
+  GstBuffer  *last_flipped;
+  GstCaps    *output_caps;
+  GstCaps    *pushed_caps;
+
+  GstElement *input_pipeline;
+  GstElement *output_pipeline;
+  GstElement *splash_pipeline;
+  GstElement *appsrc;
+  guint       input_bus_watch_id;
+  guint       output_bus_watch_id;
+  guint       splash_bus_watch_id;
+  guint       v4l2_event_poll_id;
+  guint       restart_id;
+  /* Event fd received from a previous daemon instance, already
+   * subscribed to client usage events, or -1. */
+  gint        handover_fd;
+  /* Read end of the FIFO standing in for client usage events. */
+  gint        fake_clients_fd;
+  /* Duplicate of the previous event fd held while the output pipeline is
+   * rebuilt, so that the device never loses its writer, or -1. */
+  gint        bridge_fd;
+  gboolean    draining;
+
+  /* Written before switch_pending is set, read by the streaming thread
+   * that clears it. */
+  gint64      switch_time;
+  gint        switch_pending;
+  /* When the input was last asked to start playing, or 0. */
+  gint64      input_enable_time;
+
+  /* Frame count and time of the last watchdog check that saw progress. */
+  guint       watchdog_frames;
+  gint64      watchdog_time;
+  gboolean    watchdog_fired;
+  /* Set when the input starts, until its first frame was delayed. */
+  gint        input_starting;
+
+  /* Statistics. frames and bus_* are updated from streaming threads. */
+  gint        frames;
+  gint        bus_forwarded;
+  gint        bus_filtered;
+  gint        duplicates;
+  gint        conversions_skipped;
+  guint       clients;
+  guint       events;
+  guint       actions;
+  guint       errors;
+  guint       restarts;
+};
+
+/* A loopback device created at runtime for @relay, fed by scaling the
+ * frames of the main output, but only while it has clients. */
+typedef struct
+{
+  Relay      *relay;
+  guint       width;
+  guint       height;
+  gint        device_nr;
+
+  GstElement *pipeline;
+  GstElement *appsrc;
+  guint       bus_watch_id;
+  guint       v4l2_event_poll_id;
+
+  /* Read by the streaming threads of the input and splash pipelines. */
+  gint        clients;
+} RelayExtra;
+
 static gboolean opt_background = FALSE;
 static gboolean opt_debug = FALSE;
 static gboolean opt_version = FALSE;
+static gchar *opt_config = NULL;
+static gint opt_stats_interval = 0;
+static gint opt_threads = 0;
+static gchar *opt_cpu_affinity = NULL;
+static gchar *opt_handover_socket = NULL;
+static gchar *opt_takeover = NULL;
+static gchar *opt_uevent_socket = NULL;
+static gchar *opt_loopback_control = NULL;
+static gboolean opt_fake_loopback_control = FALSE;
+static gchar *opt_fake_clients = NULL;
+static gint opt_inject_clients = 0;
+static gint opt_inject_interval = 100;
+static gint opt_inject_burst = 1;
+static gchar *opt_startup_delay = NULL;
+static gint startup_delay_min = 0;
+static gint startup_delay_max = 0;
+static gint opt_inject_errors = 0;
+static gint opt_inject_rebuild = 0;
+static gint opt_soak = 0;
+static gint opt_soak_sample = 10;
+static gint opt_soak_tolerance = 10;
+static gint opt_bench_run = 0;
+static gchar *opt_bench_group = NULL;
+static gchar *opt_bench_baseline = NULL;
+static gchar *opt_bench_results = NULL;
+static gint opt_shutdown_timeout = 500;
+static gchar *opt_trace = NULL;
+static gint opt_trace_events = 65536;
+static gchar *opt_recorder_file = NULL;
+static gint opt_recorder_seconds = 30;
+static gint opt_watchdog = 10;
+static gint opt_dedup = 0;
+static gint opt_decode_threads = 0;
+static gboolean opt_perf_counters = FALSE;
+static gint config_threads = 0;
+static gchar *config_cpu_affinity = NULL;
+static gchar *config_loopback_control = NULL;
+static gchar *opt_flip = NULL;
+static FlipMethod default_flip = FLIP_NONE;
+static gchar *opt_camera_mode = NULL;
+static gboolean default_cheapest_mode = FALSE;
 static gchar *opt_input = NULL;
 static gchar *opt_output = NULL;
 static gchar *opt_splash =
     "dataurisrc uri=data:image/png;base64,iVBORw0KGgoAAAANSUhEUgAAABAAAAAQCAIAAACQkWg2AAAAEElEQVQoz2NgGAWjYBTAAAADEAABaJFtwwAAAABJRU5ErkJggg== ! pngdec ! imagefreeze num-buffers=2 ! videoscale ! videoconvert"; /* 16x16 black PNG */
 
 static GMainLoop *loop = NULL;
-static guint input_bus_watch_id = 0;
-static guint output_bus_watch_id = 0;
-static guint splash_bus_watch_id = 0;
-static guint v4l2_event_poll_id = 0;
-static GstElement *input_pipeline = NULL;
-static GstElement *output_pipeline = NULL;
-static GstElement *splash_pipeline = NULL;
+static GPtrArray *relays = NULL;
+static GstTaskPool *task_pool = NULL;
+static GSocket *handover_socket = NULL;
+static GSource *handover_source = NULL;
+static gint64 shutdown_start = 0;
+static guint shutdown_draining = 0;
+static guint shutdown_timeout_id = 0;
+static GSocket *uevent_socket = NULL;
+static GSource *uevent_source = NULL;
+static LoopbackControl *loopback_control = NULL;
+static BenchStats *bench_live = NULL;
+static BenchStats *bench_splash = NULL;
+static BenchStats *bench_event = NULL;
+static BenchStats *bench_state = NULL;
+static GArray *inject_fds = NULL;
+static gint inject_sent = 0;
+static guint64 inject_rss_start = 0;
+static guint64 inject_rss_peak = 0;
+static gint64 inject_rss_time = 0;
+static guint inject_inconsistent = 0;
+static gint64 inject_settle_deadline = 0;
+
+typedef struct
+{
+  guint64 rss;
+  guint64 fds;
+  guint64 threads;
+  gint64  objects;
+} ProcessSample;
+
+static ProcessSample soak_first;
+static guint soak_samples = 0;
+static gboolean soak_ended = FALSE;
+static gboolean soak_failed = FALSE;
+static BenchStats *bench_frame = NULL;
+static gint bench_measuring = FALSE;
+static gint64 bench_run_warm = 0;
+static gint64 bench_run_start = 0;
+static guint bench_run_frames = 0;
+static guint64 bench_run_faults = 0;
+static gint64 bench_run_cpu = 0;
+static GKeyFile *bench_results = NULL;
+static gboolean bench_failed = FALSE;
 
 static gboolean    backend_pipeline_bus_call (GstBus      *bus,
                                               GstMessage  *msg,
                                               gpointer     data);
-static GstElement* backend_pipeline_create   (const gchar *name,
+static GstElement* backend_pipeline_create   (Relay       *relay,
+                                              const gchar *name,
                                               const gchar *description,
                                               guint       *bus_watch_id);
+static gboolean    relay_start               (Relay       *relay);
+static void        relay_stop                (Relay       *relay);
 
 static const GOptionEntry opt_entries[] =
 {
@@ -69,12 +305,85 @@ static const GOptionEntry opt_entries[] =
     &opt_debug, "Print debugging information", NULL },
   { "version",    'v', G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
     &opt_version, "Show version", NULL },
+  { "config",     'c', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_config, "Load relay instances from a configuration file", NULL},
+  { "stats-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_stats_interval, "Print per-relay statistics every N seconds", "N"},
+  { "threads",    't', G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_threads, "Share at most N streaming threads between all pipelines", "N"},
+  { "cpu-affinity", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+    &opt_cpu_affinity, "Pin streaming threads to CPUS, e.g. 0-3,6", "CPUS"},
+  { "handover-socket", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_handover_socket, "Hand relays over to a new daemon connecting to PATH", "PATH"},
+  { "takeover",   0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_takeover, "Take relays over from the daemon listening on PATH", "PATH"},
+  { "loopback-control", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_loopback_control, "Create extra devices through the v4l2loopback control device at PATH", "PATH"},
+  { "fake-loopback-control", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_NONE,
+    &opt_fake_loopback_control, "Only pretend to create extra devices", NULL},
+  { "trace",      0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_trace, "Record a timeline of frames and events, written to FILE on SIGUSR2", "FILE"},
+  { "trace-events", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_trace_events, "Keep the last N trace events of every thread (default: 65536)", "N"},
+  { "recorder-file", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_recorder_file, "Write the flight recorder to FILE on SIGUSR1, errors and frozen input (default: $TMPDIR/v4l2-relayd-recorder.log)", "FILE"},
+  { "recorder-seconds", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_recorder_seconds, "Write the last N seconds of the flight recorder (default: 30)", "N"},
+  { "watchdog",   0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_watchdog, "Report a running input without frames for N seconds, 0 to disable (default: 10)", "N"},
+  { "uevent-socket", 0, G_OPTION_FLAG_HIDDEN, G_OPTION_ARG_FILENAME,
+    &opt_uevent_socket, "Read uevents sent to PATH instead of the kernel's", "PATH"},
+  { "shutdown-timeout", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_shutdown_timeout, "Give up stopping pipelines after MS milliseconds (default: 500)", "MS"},
   { "input",      'i', G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
     &opt_input, "Specify input GStreamer pipeline description", NULL},
   { "output",     'o', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
     &opt_output, "Specify output GStreamer pipeline description", NULL},
   { "splash",     's', G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
     &opt_splash, "Specify splash GStreamer pipeline description", NULL},
+  { "camera-mode", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+    &opt_camera_mode, "Stream the camera in the output's mode, or in the mode cheapest to bring to the output: output or cheapest (default: output)", "MODE"},
+  { "decode-threads", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_decode_threads, "Take JPEG from the input and decode it on N threads, only as many frames as the output takes", "N"},
+  { "dedup",      0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_dedup, "Reuse the work done for the previous frame when a frame repeats it, hashing every Nth row, 0 to disable (default: 0)", "N"},
+  { "flip",       0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+    &opt_flip, "Mirror or rotate every frame: none, horizontal, 90, 180 or 270 degrees clockwise", "METHOD"},
+  { NULL }
+};
+
+static const GOptionEntry opt_bench_entries[] =
+{
+  { "perf-counters", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_NONE,
+    &opt_perf_counters, "Count cycles, instructions, cache misses, page faults and context switches per frame and stage", NULL},
+  { "fake-clients", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_fake_clients, "Read client counts from a FIFO per relay in DIR instead of the loopback device", "DIR"},
+  { "inject-clients", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_inject_clients, "Open and close a fake client N times, report the switch latencies and exit", "N"},
+  { "inject-interval", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_inject_interval, "Wait MS milliseconds between injected client events (default: 100)", "MS"},
+  { "inject-burst", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_inject_burst, "Send N client counts at once, the last of which opens or closes", "N"},
+  { "startup-delay", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+    &opt_startup_delay, "Hold the first input frame back MS, or MIN-MAX random, milliseconds to emulate a camera starting up", "MS"},
+  { "inject-errors", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_inject_errors, "Make the input fail on every Nth open", "N"},
+  { "inject-rebuild", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_inject_rebuild, "Destroy the input after every Nth close", "N"},
+  { "soak", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_soak, "Inject client events for SECONDS and fail if resource usage grows", "SECONDS"},
+  { "soak-sample", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_soak_sample, "Sample resource usage every SECONDS while soaking (default: 10)", "SECONDS"},
+  { "soak-tolerance", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_soak_tolerance, "Allowed growth over the first sample in percent (default: 10)", "PERCENT"},
+  { "bench-run", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_INT,
+    &opt_bench_run, "Keep a fake client on every relay, measure throughput, latency, faults and RSS for SECONDS and exit", "SECONDS"},
+  { "bench-group", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_STRING,
+    &opt_bench_group, "Name of the results in the baseline and results files (default: default)", "NAME"},
+  { "bench-baseline", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_bench_baseline, "Fail if the results regressed against the baseline keyfile FILE", "FILE"},
+  { "bench-results", 0, G_OPTION_FLAG_NONE, G_OPTION_ARG_FILENAME,
+    &opt_bench_results, "Write the results as a keyfile to FILE", "FILE"},
   { NULL }
 };
 
@@ -84,11 +393,16 @@ parse_args (int   argc,
 {
   GError *error = NULL;
   GOptionContext *context;
+  GOptionGroup *group;
 
   context = g_option_context_new ("- test tree model performance");
   g_option_context_add_main_entries (context, opt_entries, NULL);
   g_option_context_set_help_enabled (context, TRUE);
 
+  group = g_option_group_new ("bench", "Benchmarking Options:",
+                              "Show benchmarking options", NULL, NULL);
+  g_option_group_add_entries (group, opt_bench_entries);
+  g_option_context_add_group (context, group);
   g_option_context_add_group (context, gst_init_get_option_group ());
 
   if (!g_option_context_parse (context, &argc, &argv, &error))
@@ -129,12 +443,189 @@ parse_args (int   argc,
   }
 }
 
+static Relay*
+relay_new (const gchar *name,
+           const gchar *input,
+           const gchar *output,
+           const gchar *splash)
+{
+  Relay *relay;
+
+  relay = g_new0 (Relay, 1);
+  relay->name = g_strdup (name);
+  relay->trace_name = g_intern_string (name);
+  relay->input = g_strdup (input);
+  relay->output = g_strdup (output);
+  relay->splash = g_strdup (splash);
+  relay->queue_depth = DEFAULT_QUEUE_DEPTH;
+  relay->handover_fd = -1;
+  relay->bridge_fd = -1;
+  relay->fake_clients_fd = -1;
+  g_mutex_init (&relay->transform_lock);
+
+  return relay;
+}
+
+static Relay*
+relay_dup (Relay *config)
+{
+  Relay *relay;
+
+  relay = relay_new (config->name, config->input, config->output,
+                     config->splash);
+  relay->card_label = g_strdup (config->card_label);
+  relay->queue_depth = config->queue_depth;
+  relay->extra_sizes = g_strdup (config->extra_sizes);
+  relay->decode_threads = config->decode_threads;
+  relay->cheapest_mode = config->cheapest_mode;
+  if (config->crop != NULL)
+    relay->crop = crop_copy (config->crop);
+  if (config->flip != NULL)
+    relay->flip = flip_new (flip_get_method (config->flip));
+  if (config->dedup != NULL)
+    relay->dedup = dedup_new (dedup_get_step (config->dedup));
+
+  return relay;
+}
+
+static void
+relay_free (Relay *relay)
+{
+  relay_stop (relay);
+
+  if (relay->fake_clients_fd >= 0)
+    close (relay->fake_clients_fd);
+
+  g_free (relay->name);
+  g_free (relay->input);
+  g_free (relay->output);
+  g_free (relay->splash);
+  g_free (relay->card_label);
+  g_free (relay->device);
+  g_free (relay->extra_sizes);
+  g_clear_pointer (&relay->crop, crop_free);
+  g_clear_pointer (&relay->flip, flip_free);
+  g_clear_pointer (&relay->dedup, dedup_free);
+  g_clear_pointer (&relay->last_flipped, gst_buffer_unref);
+  g_clear_pointer (&relay->output_caps, gst_caps_unref);
+  g_clear_pointer (&relay->pushed_caps, gst_caps_unref);
+  g_mutex_clear (&relay->transform_lock);
+  g_free (relay);
+}
+
+static void
+recorder_write (const gchar *reason)
+{
+  GError *error = NULL;
+
+  if (!recorder_dump (opt_recorder_file,
+                      (gint64) opt_recorder_seconds * G_USEC_PER_SEC,
+                      reason, &error)) {
+    GST_WARNING ("Could not write flight recorder: %s", error->message);
+    g_error_free (error);
+  } else
+    g_message ("Flight recorder written to %s: %s", opt_recorder_file, reason);
+}
+
+/* Counts the error reported by @msg and keeps what led to it. The file
+ * is written from the main loop, so a relay failing over and over only
+ * writes it every RECORDER_ERROR_INTERVAL seconds; the errors in between
+ * are in the next dump. */
+static void
+relay_record_error (Relay      *relay,
+                    GstMessage *msg)
+{
+  static gint64 last_dump = 0;
+  const gchar *source;
+  gchar *reason;
+  gint64 now;
+
+  source = g_intern_string (GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)));
+  relay->errors++;
+  recorder_record (RECORD_ERROR, relay->trace_name, source, relay->errors);
+
+  now = g_get_monotonic_time ();
+  if (last_dump > 0 &&
+      now - last_dump < RECORDER_ERROR_INTERVAL * G_USEC_PER_SEC)
+    return;
+  last_dump = now;
+
+  reason = g_strdup_printf ("%s: error in %s", relay->name, source);
+  recorder_write (reason);
+  g_free (reason);
+}
+
+/* Runs on the thread posting the message. Only errors, EOS and state
+ * changes of the pipelines themselves are of interest to the bus watches,
+ * everything else (QOS, LATENCY, element state changes, ...) is dropped
+ * here so that it does not wake up the main loop. This is also the only
+ * point where the thread pool of a new task can be replaced before the
+ * task is started. */
+static GstBusSyncReply
+pipeline_bus_sync_handler (GstBus     *bus,
+                           GstMessage *msg,
+                           gpointer    data)
+{
+  Relay *relay = (Relay *) data;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_ERROR:
+    case GST_MESSAGE_EOS:
+    case GST_MESSAGE_APPLICATION:
+      g_atomic_int_inc (&relay->bus_forwarded);
+      return GST_BUS_PASS;
+
+    case GST_MESSAGE_STATE_CHANGED:
+      if (GST_IS_PIPELINE (GST_MESSAGE_SRC (msg)) &&
+          GST_OBJECT_PARENT (GST_MESSAGE_SRC (msg)) == NULL) {
+        const gchar *pipeline_name;
+        GstState new_state;
+
+        gst_message_parse_state_changed (msg, NULL, &new_state, NULL);
+        pipeline_name =
+            g_intern_string (GST_OBJECT_NAME (GST_MESSAGE_SRC (msg)));
+        recorder_record (RECORD_STATE, relay->trace_name, pipeline_name,
+                         new_state);
+        PROBE_STATE_COMPLETE (relay->trace_name, pipeline_name, new_state);
+        TRACE (pipeline_name, gst_element_state_get_name (new_state),
+               TRACE_INSTANT, relay->trace_name, new_state);
+        g_atomic_int_inc (&relay->bus_forwarded);
+        return GST_BUS_PASS;
+      }
+      break;
+
+    case GST_MESSAGE_STREAM_STATUS: {
+      GstStreamStatusType type;
+      GstElement *owner;
+      const GValue *value;
+
+      if (task_pool == NULL)
+        break;
+
+      gst_message_parse_stream_status (msg, &type, &owner);
+      if (type != GST_STREAM_STATUS_TYPE_CREATE)
+        break;
+
+      value = gst_message_get_stream_status_object (msg);
+      if (value != NULL && G_VALUE_HOLDS (value, GST_TYPE_TASK))
+        gst_task_set_pool (GST_TASK (g_value_get_object (value)), task_pool);
+      break;
+    }
+    default:
+      break;
+  }
+
+  g_atomic_int_inc (&relay->bus_filtered);
+  return GST_BUS_DROP;
+}
+
 static gboolean
 backend_pipeline_bus_call (GstBus     *bus,
                            GstMessage *msg,
                            gpointer    data)
 {
   GstElement *pipeline = GST_ELEMENT (data);
+  Relay *relay = g_object_get_data (G_OBJECT (pipeline), "relay");
 
   switch (GST_MESSAGE_TYPE (msg)) {
     case GST_MESSAGE_ERROR: {
@@ -144,12 +635,30 @@ backend_pipeline_bus_call (GstBus     *bus,
       gst_message_parse_error (msg, &error, &debug);
       g_free (debug);
 
-      GST_ERROR ("%s", error->message);
+      GST_ERROR ("%s: %s", relay->name, error->message);
       g_error_free (error);
 
+      relay_record_error (relay, msg);
       gst_element_set_state (pipeline, GST_STATE_NULL);
       break;
     }
+    case GST_MESSAGE_STATE_CHANGED: {
+      GstState new_state;
+
+      if (GST_MESSAGE_SRC (msg) != GST_OBJECT (pipeline) ||
+          pipeline != relay->input_pipeline || relay->input_enable_time == 0)
+        break;
+
+      gst_message_parse_state_changed (msg, NULL, &new_state, NULL);
+      if (new_state != GST_STATE_PLAYING)
+        break;
+
+      if (bench_state != NULL)
+        bench_stats_add (bench_state,
+                         g_get_monotonic_time () - relay->input_enable_time);
+      relay->input_enable_time = 0;
+      break;
+    }
     default:
       break;
   }
@@ -157,31 +666,290 @@ backend_pipeline_bus_call (GstBus     *bus,
   return TRUE;
 }
 
+/* Called for every frame from a backend pipeline: the first one coming
+ * from the pipeline a switch waits for completes the switch. */
+static void
+relay_check_switch (Relay     *relay,
+                    GstObject *pipeline)
+{
+  gint pending = g_atomic_int_get (&relay->switch_pending);
+  GstObject *expected;
+
+  if (pending == SWITCH_NONE)
+    return;
+
+  expected = GST_OBJECT (pending == SWITCH_TO_INPUT ?
+                         relay->input_pipeline : relay->splash_pipeline);
+  if (pipeline != expected ||
+      !g_atomic_int_compare_and_exchange (&relay->switch_pending, pending,
+                                          SWITCH_NONE))
+    return;
+
+  if (bench_live != NULL)
+    bench_stats_add (pending == SWITCH_TO_INPUT ? bench_live : bench_splash,
+                     g_get_monotonic_time () - relay->switch_time);
+}
+
+/* Marks buffers found to repeat the previous frame, so that the
+ * conversions of the output can push their last result again. */
+static GQuark
+repeat_quark ()
+{
+  static GQuark quark = 0;
+
+  if (quark == 0)
+    quark = g_quark_from_static_string ("v4l2-relayd-repeat");
+
+  return quark;
+}
+
+/* Returns a copy of @buffer, sharing its memory, with the timestamps of
+ * @timestamps and marked as a repeat. */
+static GstBuffer*
+repeat_buffer_new (GstBuffer *buffer,
+                   GstBuffer *timestamps)
+{
+  GstBuffer *repeat = gst_buffer_copy (buffer);
+
+  GST_BUFFER_PTS (repeat) = GST_BUFFER_PTS (timestamps);
+  GST_BUFFER_DTS (repeat) = GST_BUFFER_DTS (timestamps);
+  GST_BUFFER_DURATION (repeat) = GST_BUFFER_DURATION (timestamps);
+  gst_mini_object_set_qdata (GST_MINI_OBJECT (repeat), repeat_quark (),
+                             GINT_TO_POINTER (TRUE), NULL);
+
+  return repeat;
+}
+
+/* Called with transform_lock held. Crops, then flips, @buffer, described
+ * by @caps, taking over the reference to it, and moves the appsrcs to the
+ * caps of the result before it is pushed. Cropping only adds metadata, so
+ * the flip is the one pass over the pixels, and it is skipped for frames
+ * repeating the previous one. Splash frames, unless @from_input, are only
+ * checked for repeats: they are meant to be shown as they are. */
+static GstBuffer*
+relay_transform (Relay     *relay,
+                 GstCaps   *caps,
+                 GstBuffer *buffer,
+                 gboolean   from_input)
+{
+  GstBuffer *transformed;
+  gboolean duplicate;
+  guint i;
+
+  /* Equal caps come with a duplicate, so the pushed caps stay valid. */
+  duplicate = relay->dedup != NULL &&
+      dedup_check (relay->dedup, caps, buffer);
+  if (duplicate) {
+    g_atomic_int_inc (&relay->duplicates);
+    if (relay->last_flipped != NULL) {
+      transformed = repeat_buffer_new (relay->last_flipped, buffer);
+      gst_buffer_unref (buffer);
+      return transformed;
+    }
+  }
+
+  if (!from_input)
+    g_clear_pointer (&relay->last_flipped, gst_buffer_unref);
+  if (relay->crop != NULL && from_input) {
+    transformed = crop_buffer (relay->crop, caps, buffer, &caps);
+    gst_buffer_unref (buffer);
+    buffer = transformed;
+  }
+  if (relay->flip != NULL && from_input) {
+    transformed = flip_buffer (relay->flip, caps, buffer, &caps);
+    /* Frames passed through unflipped may belong to the camera. */
+    if (relay->dedup != NULL)
+      gst_buffer_replace (&relay->last_flipped,
+                          transformed != buffer ? transformed : NULL);
+    gst_buffer_unref (buffer);
+    buffer = transformed;
+  }
+  if (duplicate) {
+    transformed = repeat_buffer_new (buffer, buffer);
+    gst_buffer_unref (buffer);
+    buffer = transformed;
+  }
+  if (caps == relay->pushed_caps)
+    return buffer;
+
+  gst_caps_replace (&relay->pushed_caps, caps);
+  gst_app_src_set_caps (GST_APP_SRC (relay->appsrc), caps);
+  for (i = 0; relay->extras != NULL && i < relay->extras->len; i++) {
+    RelayExtra *extra = g_ptr_array_index (relay->extras, i);
+
+    gst_app_src_set_caps (GST_APP_SRC (extra->appsrc), caps);
+  }
+
+  return buffer;
+}
+
+/* Whether frames go through relay_transform. Only changes while the
+ * pipelines are stopped. */
+static gboolean
+relay_transforms (Relay *relay)
+{
+  return relay->crop != NULL || relay->flip != NULL || relay->dedup != NULL ||
+      relay->cheapest_mode;
+}
+
+/* Relays the frame of @sample, from @pipeline, to the output and the
+ * extra devices. */
+static void
+relay_push_sample (Relay     *relay,
+                   GstObject *pipeline,
+                   GstSample *sample)
+{
+  gint64 start = bench_frame != NULL ? g_get_monotonic_time () : 0;
+  GstFlowReturn flow;
+  GstBuffer *buffer;
+  guint i;
+
+  PERF_BEGIN (PERF_STAGE_RELAY);
+  buffer = gst_sample_get_buffer (sample);
+  TRACE ("frame", "relay", TRACE_BEGIN, relay->trace_name,
+         GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer)));
+  recorder_record (RECORD_FRAME, relay->trace_name, NULL,
+                   GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer)));
+  PROBE_FRAME_RECEIVE (relay->trace_name, GST_BUFFER_PTS (buffer));
+  relay_check_switch (relay, pipeline);
+  gst_buffer_ref (buffer);
+  if (relay_transforms (relay)) {
+    g_mutex_lock (&relay->transform_lock);
+    buffer = relay_transform (relay, gst_sample_get_caps (sample), buffer,
+                              pipeline == GST_OBJECT (relay->input_pipeline));
+  }
+  /* gst_app_src_push_buffer wants to take the ownership of the buffer,
+   * so it must hold an additional reference first. */
+  flow = gst_app_src_push_buffer (GST_APP_SRC (relay->appsrc),
+                                  gst_buffer_ref (buffer));
+  if (flow == GST_FLOW_OK)
+    PROBE_FRAME_PUSH (relay->trace_name, GST_BUFFER_PTS (buffer));
+  else {
+    recorder_record (RECORD_DROP, relay->trace_name, NULL,
+                     GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer)));
+    PROBE_FRAME_DROP (relay->trace_name, GST_BUFFER_PTS (buffer), flow);
+  }
+
+  /* The extras only change while the backend pipelines are stopped. */
+  for (i = 0; relay->extras != NULL && i < relay->extras->len; i++) {
+    RelayExtra *extra = g_ptr_array_index (relay->extras, i);
+
+    if (g_atomic_int_get (&extra->clients) > 0)
+      gst_app_src_push_buffer (GST_APP_SRC (extra->appsrc),
+                               gst_buffer_ref (buffer));
+  }
+  if (relay_transforms (relay))
+    g_mutex_unlock (&relay->transform_lock);
+  gst_buffer_unref (buffer);
+  TRACE ("frame", "relay", TRACE_END, relay->trace_name, 0);
+  PERF_END (PERF_STAGE_RELAY);
+  if (start > 0 && g_atomic_int_get (&bench_measuring))
+    bench_stats_add (bench_frame, g_get_monotonic_time () - start);
+
+  g_atomic_int_inc (&relay->frames);
+}
+
+/* Runs on a decoder worker, which delivers one frame at a time. The
+ * decoder belongs to the input pipeline and is freed with it, after the
+ * pipeline stopped, so frames still being decoded then get here while
+ * input_pipeline is being destroyed, but never after it was cleared. */
+static void
+relay_decoded_cb (GstSample *sample,
+                  gpointer   user_data)
+{
+  Relay *relay = (Relay *) user_data;
+
+  relay_push_sample (relay, GST_OBJECT (relay->input_pipeline), sample);
+}
+
 static GstFlowReturn
 backend_appsink_new_sample (GstAppSink *appsink,
                             gpointer    user_data)
 {
-  GstAppSrc *appsrc = (GstAppSrc *) user_data;
+  Relay *relay = (Relay *) user_data;
+  GstObject *pipeline = GST_OBJECT_PARENT (appsink);
+  Decoder *decoder;
   GstSample *sample;
-  GstBuffer *buffer;
 
+  PERF_LAP (PERF_STAGE_INPUT);
   sample = gst_app_sink_pull_sample (appsink);
-  buffer = gst_sample_get_buffer (sample);
-  /* gst_app_src_push_buffer wants to take the ownership of the buffer,
-   * so it must hold an additional reference first. */
-  gst_buffer_ref (buffer);
-  gst_app_src_push_buffer (appsrc, buffer);
+  decoder = g_object_get_data (G_OBJECT (pipeline), "decoder");
+  if (decoder != NULL)
+    decoder_push (decoder, sample);
+  else
+    relay_push_sample (relay, pipeline, sample);
   gst_sample_unref (sample);
 
   return GST_FLOW_OK;
 }
 
+/* Emulates a camera that takes a while to deliver its first frame. */
+static GstPadProbeReturn
+startup_delay_probe (GstPad          *pad,
+                     GstPadProbeInfo *info,
+                     gpointer         user_data)
+{
+  Relay *relay = (Relay *) user_data;
+
+  if (g_atomic_int_compare_and_exchange (&relay->input_starting, TRUE, FALSE))
+    g_usleep ((startup_delay_min +
+               g_random_int_range (0, startup_delay_max -
+                                      startup_delay_min + 1)) * 1000);
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Brings @pipeline to READY, for the camera to list its modes, and
+ * returns the caps of the one among those offered by @src_pad that is
+ * cheapest to bring to @caps, the fixed caps the output takes, taking
+ * over @caps. Returns @caps when none is cheaper, or the modes cannot be
+ * listed. */
+static GstCaps*
+relay_select_camera_mode (Relay      *relay,
+                          GstElement *pipeline,
+                          GstPad     *src_pad,
+                          GstCaps    *caps)
+{
+  GstCaps *available, *mode;
+  GstVideoInfo wanted;
+  gdouble cost;
+  gchar *str;
+
+  if (!gst_caps_is_fixed (caps) || !gst_video_info_from_caps (&wanted, caps))
+    return caps;
+
+  if (gst_element_set_state (pipeline, GST_STATE_READY) ==
+      GST_STATE_CHANGE_FAILURE) {
+    GST_WARNING ("%s: Cannot list the camera modes", relay->name);
+    gst_element_set_state (pipeline, GST_STATE_NULL);
+    return caps;
+  }
+  available = gst_pad_query_caps (src_pad, NULL);
+  mode = camera_mode_select (available, &wanted, &cost);
+  gst_caps_unref (available);
+  if (mode == NULL) {
+    GST_INFO ("%s: Streaming the camera in the output mode", relay->name);
+    return caps;
+  }
+
+  str = gst_caps_to_string (mode);
+  g_message ("%s: Streaming the camera in %s, %.1f MB per frame against "
+             "%.1f MB in the output mode", relay->name, str, cost / 1e6,
+             camera_mode_get_cost (&wanted, &wanted) / 1e6);
+  g_free (str);
+  gst_caps_unref (caps);
+
+  return mode;
+}
+
 static GstElement*
-backend_pipeline_create (const gchar *name,
+backend_pipeline_create (Relay       *relay,
+                         const gchar *name,
                          const gchar *description,
                          guint       *bus_watch_id)
 {
-  GstElement *appsrc, *pipeline, *appsink, *element;
+  gboolean input = g_str_equal (name, "input-pipeline");
+  GstElement *pipeline, *appsink, *element;
   GstPad *src_pad;
   GstClock *clock;
   GError *error = NULL;
@@ -191,7 +959,7 @@ backend_pipeline_create (const gchar *name,
   element = gst_parse_launch_full (description, NULL,
                                    GST_PARSE_FLAG_FATAL_ERRORS, &error);
   if (element == NULL) {
-    GST_ERROR ("%s", error->message);
+    GST_ERROR ("%s: %s", relay->name, error->message);
     g_error_free (error);
     return NULL;
   }
@@ -202,10 +970,11 @@ backend_pipeline_create (const gchar *name,
     pipeline = element;
   gst_object_ref_sink (pipeline);
   gst_element_set_name (pipeline, name);
+  g_object_set_data (G_OBJECT (pipeline), "relay", relay);
 
   src_pad = gst_bin_find_unlinked_pad (GST_BIN (pipeline), GST_PAD_SRC);
   if (src_pad == NULL) {
-    GST_ERROR ("no src pad available in %s", name);
+    GST_ERROR ("%s: no src pad available in %s", relay->name, name);
     gst_object_unref (pipeline);
     return NULL;
   }
@@ -213,32 +982,114 @@ backend_pipeline_create (const gchar *name,
   clock = gst_system_clock_obtain ();
   gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
   gst_element_set_base_time (pipeline,
-                             gst_element_get_base_time (output_pipeline));
+                             gst_element_get_base_time (relay->output_pipeline));
   gst_element_set_start_time (pipeline, GST_CLOCK_TIME_NONE);
   gst_object_unref (clock);
 
-  appsrc = gst_bin_get_by_name (GST_BIN (output_pipeline), "appsrc");
-  caps = gst_app_src_get_caps (GST_APP_SRC (appsrc));
+  if (input && relay->crop != NULL && relay->output_caps != NULL) {
+    guint i;
+
+    /* Let the camera stream at its own size, to be cropped from. */
+    caps = gst_caps_copy (relay->output_caps);
+    for (i = 0; i < gst_caps_get_size (caps); i++)
+      gst_structure_remove_fields (gst_caps_get_structure (caps, i),
+                                   "width", "height", "pixel-aspect-ratio",
+                                   NULL);
+  } else if (input && relay->flip != NULL &&
+             FLIP_METHOD_IS_ROTATION (flip_get_method (relay->flip)) &&
+             relay->output_caps != NULL) {
+    guint i;
+
+    /* Ask for the output turned on its side, to be rotated back. */
+    caps = gst_caps_copy (relay->output_caps);
+    for (i = 0; i < gst_caps_get_size (caps); i++) {
+      GstStructure *structure = gst_caps_get_structure (caps, i);
+      gint width, height, par_n, par_d;
+
+      if (gst_structure_get_int (structure, "width", &width) &&
+          gst_structure_get_int (structure, "height", &height))
+        gst_structure_set (structure,
+                           "width", G_TYPE_INT, height,
+                           "height", G_TYPE_INT, width,
+                           NULL);
+      if (gst_structure_get_fraction (structure, "pixel-aspect-ratio",
+                                      &par_n, &par_d))
+        gst_structure_set (structure,
+                           "pixel-aspect-ratio", GST_TYPE_FRACTION,
+                           par_d, par_n, NULL);
+    }
+  } else if (relay->output_caps != NULL)
+    caps = gst_caps_ref (relay->output_caps);
+  else
+    caps = gst_app_src_get_caps (GST_APP_SRC (relay->appsrc));
+
+  /* Let the camera stream in its own mode when that is cheaper, the
+   * output converting and scaling it. A crop takes the camera at its
+   * own size already, and a decoder any size the JPEG comes in. */
+  if (relay->cheapest_mode && relay->crop == NULL &&
+      relay->decode_threads == 0 && input)
+    caps = relay_select_camera_mode (relay, pipeline, src_pad, caps);
+
+  /* Decode on workers of our own, the input only delivering JPEG. */
+  if (relay->decode_threads > 0 && input) {
+    static const gchar *fields[] = { "width", "height", "framerate" };
+    GstCaps *jpeg_caps = gst_caps_new_empty_simple ("image/jpeg");
+    Decoder *decoder;
+    guint i;
+
+    decoder = decoder_new (relay->decode_threads, caps, relay_decoded_cb,
+                           relay, &error);
+    if (decoder == NULL) {
+      GST_ERROR ("%s: %s", relay->name, error->message);
+      g_error_free (error);
+      gst_caps_unref (jpeg_caps);
+      gst_caps_unref (caps);
+      gst_object_unref (src_pad);
+      gst_object_unref (pipeline);
+      return NULL;
+    }
+    g_object_set_data_full (G_OBJECT (pipeline), "decoder", decoder,
+                            (GDestroyNotify) decoder_free);
+
+    for (i = 0; gst_caps_get_size (caps) > 0 && i < G_N_ELEMENTS (fields);
+         i++) {
+      const GValue *value =
+          gst_structure_get_value (gst_caps_get_structure (caps, 0),
+                                   fields[i]);
+
+      if (value != NULL)
+        gst_structure_set_value (gst_caps_get_structure (jpeg_caps, 0),
+                                 fields[i], value);
+    }
+    gst_caps_unref (caps);
+    caps = jpeg_caps;
+  }
 
   appsink = gst_element_factory_make ("appsink", NULL);
   g_object_set (appsink,
                 "caps", caps,
                 "drop", TRUE,
-                "max-buffers", 4,
+                "max-buffers", relay->queue_depth,
                 "emit-signals", TRUE,
                 NULL);
-  g_signal_connect_object (appsink,
-                           "new-sample", (GCallback) backend_appsink_new_sample,
-                           appsrc, 0);
+  g_signal_connect (appsink,
+                    "new-sample", (GCallback) backend_appsink_new_sample,
+                    relay);
   gst_caps_unref (caps);
 
+  if (startup_delay_max > 0 && input)
+    gst_pad_add_probe (src_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                       startup_delay_probe, relay, NULL);
+
   gst_bin_add (GST_BIN (pipeline), appsink);
+  gst_element_sync_state_with_parent (appsink);
   element = gst_pad_get_parent_element (src_pad);
   gst_element_link (element, appsink);
   gst_object_unref (element);
   gst_object_unref (src_pad);
 
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, pipeline_bus_sync_handler, relay, NULL);
   *bus_watch_id = gst_bus_add_watch_full (bus, G_PRIORITY_DEFAULT,
                                           backend_pipeline_bus_call,
                                           gst_object_ref (pipeline),
@@ -249,71 +1100,104 @@ backend_pipeline_create (const gchar *name,
 }
 
 static GstElement*
-input_pipeline_get ()
+input_pipeline_get (Relay *relay)
 {
-  if (input_pipeline == NULL) {
-    input_pipeline = backend_pipeline_create ("input-pipeline", opt_input,
-                                              &input_bus_watch_id);
+  if (relay->input_pipeline == NULL) {
+    relay->input_pipeline =
+        backend_pipeline_create (relay, "input-pipeline", relay->input,
+                                 &relay->input_bus_watch_id);
   }
-  return input_pipeline;
+  return relay->input_pipeline;
 }
 
 static GstElement*
-splash_pipeline_get ()
+splash_pipeline_get (Relay *relay)
 {
-  if (splash_pipeline == NULL) {
-    splash_pipeline = backend_pipeline_create ("splash-pipeline", opt_splash,
-                                               &splash_bus_watch_id);
+  if (relay->splash_pipeline == NULL) {
+    relay->splash_pipeline =
+        backend_pipeline_create (relay, "splash-pipeline", relay->splash,
+                                 &relay->splash_bus_watch_id);
   }
-  return splash_pipeline;
+  return relay->splash_pipeline;
 }
 
 static void
-input_pipeline_enable ()
+relay_set_state (Relay      *relay,
+                 GstElement *pipeline,
+                 GstState    state)
 {
-  gst_element_set_state (splash_pipeline_get (), GST_STATE_NULL);
-  gst_element_set_state (input_pipeline_get (), GST_STATE_PLAYING);
+  PROBE_STATE_REQUEST (relay->trace_name, GST_OBJECT_NAME (pipeline), state);
+  gst_element_set_state (pipeline, state);
 }
 
 static void
-input_pipeline_disable ()
+input_pipeline_enable (Relay *relay)
 {
-  if (input_pipeline != NULL)
-    gst_element_set_state (input_pipeline, GST_STATE_NULL);
-  if (input_pipeline != NULL)
-    gst_element_set_state (splash_pipeline, GST_STATE_PLAYING);
+  GstElement *pipeline;
+
+  pipeline = splash_pipeline_get (relay);
+  if (pipeline != NULL)
+    relay_set_state (relay, pipeline, GST_STATE_NULL);
+  pipeline = input_pipeline_get (relay);
+  if (pipeline != NULL) {
+    relay->input_enable_time = g_get_monotonic_time ();
+    g_atomic_int_set (&relay->input_starting, TRUE);
+    relay_set_state (relay, pipeline, GST_STATE_PLAYING);
+  }
 }
 
 static gboolean
-v4l2sink_event_callback (gint         fd,
-                         GIOCondition condition,
-                         gpointer     user_data G_GNUC_UNUSED)
+input_pipeline_is_enabled (Relay *relay)
+{
+  return relay->input_pipeline != NULL &&
+      GST_STATE_TARGET (relay->input_pipeline) == GST_STATE_PLAYING;
+}
+
+static void
+input_pipeline_disable (Relay *relay)
+{
+  if (relay->input_pipeline != NULL)
+    relay_set_state (relay, relay->input_pipeline, GST_STATE_NULL);
+  if (relay->input_pipeline != NULL && relay->splash_pipeline != NULL)
+    relay_set_state (relay, relay->splash_pipeline, GST_STATE_PLAYING);
+}
+
+/* Drains every pending event before acting, so that a burst of client
+ * open/close events results in at most one pipeline switch towards the
+ * final client count. Returns FALSE if no client usage event was
+ * pending. */
+static gboolean
+v4l2_event_get_clients (Relay  *relay,
+                        gint    fd,
+                        guint  *clients,
+                        gint64 *time)
 {
   struct v4l2_event event;
+  gboolean have_usage = FALSE;
   int ret;
 
-  if (!(condition & G_IO_PRI))
-    return TRUE;
-
   do {
     memset (&event, 0, sizeof (event));
 
     ret = ioctl (fd, VIDIOC_DQEVENT, &event);
     if (ret < 0)
-      return TRUE;
+      break;
 
-    GST_TRACE ("Received V4L2 event type %u", event.type);
+    GST_TRACE ("%s: Received V4L2 event type %u", relay->name, event.type);
     switch (event.type) {
       case V4L2_EVENT_PRI_CLIENT_USAGE: {
         struct v4l2_event_client_usage usage;
 
         memcpy (&usage, &event.u, sizeof usage);
-        GST_DEBUG ("Current V4L2 client: %u", usage.count);
-        if (usage.count)
-          input_pipeline_enable ();
-        else
-          input_pipeline_disable ();
-
+        GST_TRACE ("%s: V4L2 client count event: %u",
+                   relay->name, usage.count);
+        relay->events++;
+        *clients = usage.count;
+        /* Event timestamps are taken from CLOCK_MONOTONIC. */
+        *time = event.timestamp.tv_sec * G_USEC_PER_SEC +
+            event.timestamp.tv_nsec / 1000;
+        PROBE_V4L2_EVENT (relay->trace_name, usage.count, *time);
+        have_usage = TRUE;
         break;
       }
       default:
@@ -321,66 +1205,280 @@ v4l2sink_event_callback (gint         fd,
     }
   } while (event.pending);
 
+  return have_usage;
+}
+
+static guint
+relay_get_clients (Relay *relay)
+{
+  guint clients = relay->clients;
+  guint i;
+
+  for (i = 0; relay->extras != NULL && i < relay->extras->len; i++) {
+    RelayExtra *extra = g_ptr_array_index (relay->extras, i);
+
+    clients += g_atomic_int_get (&extra->clients);
+  }
+
+  return clients;
+}
+
+/* Records the client count of the main device, or of @extra, and runs
+ * the input as long as any device of the relay has clients. @time is
+ * when the count changed, the start of a resulting switch. */
+static void
+relay_set_clients (Relay      *relay,
+                   RelayExtra *extra,
+                   guint       clients,
+                   gint64      time)
+{
+  guint before, after;
+
+  before = relay_get_clients (relay);
+  if (extra != NULL)
+    g_atomic_int_set (&extra->clients, clients);
+  else
+    relay->clients = clients;
+  after = relay_get_clients (relay);
+  TRACE ("v4l2", "clients", TRACE_INSTANT, relay->trace_name, after);
+  recorder_record (RECORD_CLIENTS, relay->trace_name, NULL, after);
+
+  GST_DEBUG ("%s: Current V4L2 client: %u", relay->name, after);
+  /* An input pipeline that stopped on an error is retried on the next
+   * client event. */
+  if ((after > 0) != (before > 0) ||
+      (after > 0 && !input_pipeline_is_enabled (relay))) {
+    relay->actions++;
+    relay->switch_time = time;
+    g_atomic_int_set (&relay->switch_pending,
+                      after ? SWITCH_TO_INPUT : SWITCH_TO_SPLASH);
+    if (after)
+      input_pipeline_enable (relay);
+    else
+      input_pipeline_disable (relay);
+  }
+}
+
+static gboolean
+v4l2sink_event_callback (gint         fd,
+                         GIOCondition condition,
+                         gpointer     user_data)
+{
+  Relay *relay = (Relay *) user_data;
+  guint clients = 0;
+  gint64 time;
+
+  if (!(condition & G_IO_PRI))
+    return TRUE;
+
+  if (v4l2_event_get_clients (relay, fd, &clients, &time))
+    relay_set_clients (relay, NULL, clients, time);
+
   return TRUE;
 }
 
+static gboolean
+fake_clients_callback (gint         fd,
+                       GIOCondition condition G_GNUC_UNUSED,
+                       gpointer     user_data)
+{
+  Relay *relay = (Relay *) user_data;
+  guint clients = 0;
+  gint64 sent_at = 0;
+
+  if (!fake_clients_read (fd, &clients, &sent_at))
+    return TRUE;
+
+  if (bench_event != NULL && sent_at > 0)
+    bench_stats_add (bench_event, g_get_monotonic_time () - sent_at);
+  relay->events++;
+  relay_set_clients (relay, NULL, clients,
+                     sent_at > 0 ? sent_at : g_get_monotonic_time ());
+
+  return TRUE;
+}
+
+/* Watches the FIFO of @relay instead of its loopback device. */
+static guint
+fake_clients_watch (Relay *relay)
+{
+  if (relay->fake_clients_fd < 0) {
+    GError *error = NULL;
+
+    relay->fake_clients_fd = fake_clients_open (opt_fake_clients,
+                                                relay->name, &error);
+    if (relay->fake_clients_fd < 0) {
+      GST_WARNING ("%s: %s", relay->name, error->message);
+      g_error_free (error);
+      return 0;
+    }
+  }
+
+  return g_unix_fd_add (relay->fake_clients_fd, G_IO_IN,
+                        fake_clients_callback, relay);
+}
+
+static gboolean
+extra_event_callback (gint         fd,
+                      GIOCondition condition,
+                      gpointer     user_data)
+{
+  RelayExtra *extra = (RelayExtra *) user_data;
+  guint clients = 0;
+  gint64 time;
+
+  if (!(condition & G_IO_PRI))
+    return TRUE;
+
+  if (v4l2_event_get_clients (extra->relay, fd, &clients, &time))
+    relay_set_clients (extra->relay, extra, clients, time);
+
+  return TRUE;
+}
+
+/* Subscribes to client usage events on the v4l2sink of @pipeline and
+ * returns the id of the source watching for them, or 0. */
+static guint
+v4l2sink_watch_clients (Relay             *relay,
+                        GstElement        *pipeline,
+                        GUnixFDSourceFunc  callback,
+                        gpointer           user_data)
+{
+  struct v4l2_event_subscription sub;
+  GstElement *v4l2sink;
+  guint id = 0;
+  int fd = -1;
+
+  v4l2sink = gst_bin_get_by_name (GST_BIN (pipeline), "v4l2sink");
+  if (v4l2sink == NULL)
+    return 0;
+
+  g_object_get (v4l2sink, "device-fd", &fd, NULL);
+
+  memset (&sub, 0, sizeof (sub));
+  sub.type = V4L2_EVENT_PRI_CLIENT_USAGE;
+  sub.id = 0;
+  sub.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
+  if (ioctl (fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == 0)
+    id = g_unix_fd_add (fd, G_IO_PRI, callback, user_data);
+  else
+    GST_WARNING ("%s: V4L2_EVENT_PRI_CLIENT_USAGE not supported",
+                 relay->name);
+
+  gst_object_unref (v4l2sink);
+
+  return id;
+}
+
+static gboolean
+relay_restart_cb (gpointer user_data)
+{
+  Relay *relay = (Relay *) user_data;
+
+  relay->restart_id = 0;
+  relay->restarts++;
+
+  GST_INFO ("%s: Restarting relay", relay->name);
+  if (!relay_start (relay))
+    relay->restart_id = g_timeout_add_seconds (RELAY_RESTART_DELAY,
+                                               relay_restart_cb, relay);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* A failed relay must not take the others down with it. When relays come
+ * from a configuration file the failed one is torn down and restarted
+ * later; a single command line relay keeps quitting the main loop so that
+ * the service manager sees the failure. */
+static void
+relay_fail (Relay *relay)
+{
+  if (opt_config == NULL) {
+    g_main_loop_quit (loop);
+    return;
+  }
+
+  if (relay->restart_id > 0)
+    return;
+
+  relay_stop (relay);
+  GST_WARNING ("%s: Relay failed, restarting in %u seconds",
+               relay->name, RELAY_RESTART_DELAY);
+  relay->restart_id = g_timeout_add_seconds (RELAY_RESTART_DELAY,
+                                             relay_restart_cb, relay);
+}
+
 static gboolean
 output_pipeline_bus_call (GstBus     *bus,
                           GstMessage *msg,
-                          gpointer    data G_GNUC_UNUSED)
+                          gpointer    data)
 {
+  Relay *relay = (Relay *) data;
+
   switch (GST_MESSAGE_TYPE (msg)) {
     case GST_MESSAGE_STATE_CHANGED: {
       GstState old_state, new_state;
-      GstElement *v4l2sink;
-      int fd = -1;
-      struct v4l2_event_subscription sub;
 
-      if (!GST_IS_PIPELINE (GST_MESSAGE_SRC (msg)))
+      if (GST_MESSAGE_SRC (msg) != GST_OBJECT (relay->output_pipeline))
         break;
 
-      g_assert (GST_ELEMENT (GST_MESSAGE_SRC (msg)) == output_pipeline);
-
       gst_message_parse_state_changed (msg, &old_state, &new_state, NULL);
-      GST_DEBUG ("Output pipeline state changed from %s to %s",
+      GST_DEBUG ("%s: Output pipeline state changed from %s to %s",
+                 relay->name,
                  gst_element_state_get_name (old_state),
                  gst_element_state_get_name (new_state));
 
       if (old_state == GST_STATE_PLAYING) {
-        if (v4l2_event_poll_id > 0) {
-          g_source_remove (v4l2_event_poll_id);
-          v4l2_event_poll_id = 0;
+        if (relay->v4l2_event_poll_id > 0) {
+          g_source_remove (relay->v4l2_event_poll_id);
+          relay->v4l2_event_poll_id = 0;
         }
         break;
       }
 
-      if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED)
-        gst_element_set_state (splash_pipeline_get (), GST_STATE_PLAYING);
+      if (old_state == GST_STATE_READY && new_state == GST_STATE_PAUSED) {
+        GstElement *pipeline = splash_pipeline_get (relay);
+
+        if (pipeline != NULL)
+          gst_element_set_state (pipeline, GST_STATE_PLAYING);
+      }
 
       if (new_state != GST_STATE_PLAYING)
         break;
 
-      v4l2sink = gst_bin_get_by_name (GST_BIN (output_pipeline), "v4l2sink");
-      if (v4l2sink == NULL)
+      /* The subscription made by the previous daemon is still alive on
+       * the handed over fd, so keep listening there and resume with the
+       * client count it reported. */
+      if (relay->handover_fd >= 0) {
+        relay->v4l2_event_poll_id =
+            g_unix_fd_add (relay->handover_fd, G_IO_PRI,
+                           v4l2sink_event_callback, relay);
+        if (relay->clients > 0)
+          input_pipeline_enable (relay);
         break;
+      }
 
-      g_object_get (v4l2sink, "device-fd", &fd, NULL);
-
-      memset (&sub, 0, sizeof (sub));
-      sub.type = V4L2_EVENT_PRI_CLIENT_USAGE;
-      sub.id = 0;
-      sub.flags = V4L2_EVENT_SUB_FL_SEND_INITIAL;
-      if (ioctl (fd, VIDIOC_SUBSCRIBE_EVENT, &sub) == 0)
-        v4l2_event_poll_id =
-            g_unix_fd_add (fd, G_IO_PRI, v4l2sink_event_callback, NULL);
+      if (opt_fake_clients != NULL)
+        relay->v4l2_event_poll_id = fake_clients_watch (relay);
       else
-        GST_WARNING ("V4L2_EVENT_PRI_CLIENT_USAGE not supported");
+        relay->v4l2_event_poll_id =
+            v4l2sink_watch_clients (relay, relay->output_pipeline,
+                                    v4l2sink_event_callback, relay);
 
-      gst_object_unref (v4l2sink);
+      if (relay->bridge_fd >= 0) {
+        close (relay->bridge_fd);
+        relay->bridge_fd = -1;
+      }
       break;
     }
     case GST_MESSAGE_EOS:
-      g_main_loop_quit (loop);
+      if (relay->draining) {
+        relay->draining = FALSE;
+        if (--shutdown_draining == 0)
+          g_main_loop_quit (loop);
+        break;
+      }
+      relay_fail (relay);
       break;
 
     case GST_MESSAGE_ERROR: {
@@ -390,10 +1488,22 @@ output_pipeline_bus_call (GstBus     *bus,
       gst_message_parse_error (msg, &error, &debug);
       g_free (debug);
 
-      GST_ERROR ("%s", error->message);
+      GST_ERROR ("%s: %s", relay->name, error->message);
       g_error_free (error);
 
-      g_main_loop_quit (loop);
+      relay_record_error (relay, msg);
+      /* v4l2sink opens the device anew next to the handed over fd, which
+       * the device may refuse. Give the fd up and start over as if there
+       * had been no handover rather than failing the relay. */
+      if (relay->handover_fd >= 0 && relay->restart_id == 0) {
+        GST_WARNING ("%s: Cannot stream after taking over, starting afresh",
+                     relay->name);
+        relay_stop (relay);
+        if (!relay_start (relay))
+          relay_fail (relay);
+        break;
+      }
+      relay_fail (relay);
       break;
     }
     default:
@@ -403,21 +1513,398 @@ output_pipeline_bus_call (GstBus     *bus,
   return TRUE;
 }
 
-static GstElement*
-output_pipeline_create ()
+static gboolean
+v4l2_device_has_label (const gchar *devname,
+                       const gchar *label)
 {
-  GstElement *pipeline, *appsrc;
-  GstClock *clock;
-  GError *error = NULL;
-  GstBus *bus;
+  gboolean matches = FALSE;
+  gchar *path, *name;
 
-  pipeline = gst_parse_launch (opt_output, &error);
-  if (pipeline == NULL) {
-    GST_ERROR ("%s", error->message);
-    g_error_free (error);
-    return NULL;
+  path = g_build_filename (V4L2_SYSFS_DIR, devname, "name", NULL);
+  if (g_file_get_contents (path, &name, NULL, NULL)) {
+    matches = g_strcmp0 (g_strchomp (name), label) == 0;
+    g_free (name);
+  }
+  g_free (path);
+
+  return matches;
+}
+
+/* Returns the device node of the video4linux device whose card label is
+ * @label, picking the lowest node name when several match. */
+static gchar*
+v4l2_device_find_by_label (const gchar *label)
+{
+  const gchar *entry;
+  gchar *found = NULL;
+  GDir *dir;
+
+  dir = g_dir_open (V4L2_SYSFS_DIR, 0, NULL);
+  if (dir == NULL)
+    return NULL;
+
+  while ((entry = g_dir_read_name (dir)) != NULL) {
+    if (v4l2_device_has_label (entry, label) &&
+        (found == NULL || g_strcmp0 (entry, found) < 0)) {
+      g_free (found);
+      found = g_strdup (entry);
+    }
+  }
+  g_dir_close (dir);
+
+  if (found != NULL) {
+    gchar *device = g_strconcat ("/dev/", found, NULL);
+
+    g_free (found);
+    return device;
+  }
+
+  return NULL;
+}
+
+static GstPadProbeReturn
+trace_probe (GstPad          *pad,
+             GstPadProbeInfo *info,
+             gpointer         user_data)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  const gchar *relay = g_object_get_data (G_OBJECT (pad), "trace-relay");
+  gchar phase = GPOINTER_TO_INT (user_data);
+
+  trace_record ("frame", phase == TRACE_INSTANT ? "render" : "convert",
+                phase, relay, GST_TIME_AS_USECONDS (GST_BUFFER_PTS (buffer)));
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+trace_probe_add (GstElement  *element,
+                 const gchar *pad_name,
+                 gchar        phase,
+                 Relay       *relay)
+{
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  if (pad == NULL)
+    return;
+  g_object_set_data (G_OBJECT (pad), "trace-relay",
+                     (gpointer) relay->trace_name);
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, trace_probe,
+                     GINT_TO_POINTER (phase), NULL);
+  gst_object_unref (pad);
+}
+
+/* Marks conversion in the converters and scalers, which run on the
+ * thread that pushes into them, and arrival at the v4l2sink. */
+static void
+trace_probes_add (const GValue *value,
+                  gpointer      user_data)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (value));
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factory_name;
+
+  if (factory == NULL)
+    return;
+
+  factory_name = gst_plugin_feature_get_name (factory);
+  if (g_str_equal (factory_name, "videoconvert") ||
+      g_str_equal (factory_name, "videoscale")) {
+    trace_probe_add (element, "sink", TRACE_BEGIN, user_data);
+    trace_probe_add (element, "src", TRACE_END, user_data);
+  } else if (g_str_equal (factory_name, "v4l2sink"))
+    trace_probe_add (element, "sink", TRACE_INSTANT, user_data);
+}
+
+static GstPadProbeReturn
+perf_probe (GstPad          *pad,
+            GstPadProbeInfo *info,
+            gpointer         user_data)
+{
+  switch (GPOINTER_TO_INT (user_data)) {
+    case TRACE_BEGIN:
+      perf_counters_begin (PERF_STAGE_CONVERT);
+      break;
+    case TRACE_END:
+      perf_counters_end (PERF_STAGE_CONVERT);
+      break;
+    default:
+      perf_counters_lap (PERF_STAGE_OUTPUT);
+      break;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void
+perf_probe_add (GstElement  *element,
+                const gchar *pad_name,
+                gchar        phase)
+{
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad (element, pad_name);
+  if (pad == NULL)
+    return;
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, perf_probe,
+                     GINT_TO_POINTER (phase), NULL);
+  gst_object_unref (pad);
+}
+
+/* Counts conversion like trace_probes_add, and the whole output
+ * streaming thread from one buffer leaving the appsrc to the next. */
+static void
+perf_probes_add (const GValue *value,
+                 gpointer      user_data G_GNUC_UNUSED)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (value));
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factory_name;
+
+  if (factory == NULL)
+    return;
+
+  factory_name = gst_plugin_feature_get_name (factory);
+  if (g_str_equal (factory_name, "videoconvert") ||
+      g_str_equal (factory_name, "videoscale")) {
+    perf_probe_add (element, "sink", TRACE_BEGIN);
+    perf_probe_add (element, "src", TRACE_END);
+  } else if (g_str_equal (factory_name, "appsrc"))
+    perf_probe_add (element, "src", TRACE_INSTANT);
+}
+
+/* Last result of a conversion, pushed again in place of converting a
+ * repeat. Nothing is kept while the element passes buffers through.
+ * Results from pools of bounded size are not held on to, that could
+ * leave the conversion waiting for a free buffer, but copied once the
+ * first repeat of a run was converted. */
+typedef struct
+{
+  Relay         *relay;
+  GstElement    *element;
+  GstPad        *src_pad;
+  GstBuffer     *last;
+  GstBufferPool *pool;
+  gboolean       pool_bounded;
+  gboolean       converting_repeat;
+} RepeatCache;
+
+static void
+repeat_cache_free (RepeatCache *cache)
+{
+  gst_object_unref (cache->src_pad);
+  g_clear_pointer (&cache->last, gst_buffer_unref);
+  if (cache->pool != NULL)
+    gst_object_unref (cache->pool);
+  g_free (cache);
+}
+
+/* gst_buffer_copy_deep () needs GStreamer 1.6. */
+static GstBuffer*
+buffer_copy_deep (GstBuffer *buffer)
+{
+  GstBuffer *copy;
+  GstMapInfo map;
+
+  if (!gst_buffer_map (buffer, &map, GST_MAP_READ))
+    return NULL;
+  copy = gst_buffer_new_allocate (NULL, map.size, NULL);
+  gst_buffer_fill (copy, 0, map.data, map.size);
+  gst_buffer_unmap (buffer, &map);
+  gst_buffer_copy_into (copy, buffer, GST_BUFFER_COPY_METADATA, 0, -1);
+
+  return copy;
+}
+
+static gboolean
+buffer_pool_is_bounded (GstBufferPool *pool)
+{
+  GstStructure *config;
+  guint max_buffers = 0;
+
+  config = gst_buffer_pool_get_config (pool);
+  gst_buffer_pool_config_get_params (config, NULL, NULL, NULL, &max_buffers);
+  gst_structure_free (config);
+
+  return max_buffers > 0;
+}
+
+static GstPadProbeReturn
+repeat_sink_probe (GstPad          *pad,
+                   GstPadProbeInfo *info,
+                   gpointer         user_data)
+{
+  RepeatCache *cache = (RepeatCache *) user_data;
+  GstBuffer *buffer;
+
+  if (GST_PAD_PROBE_INFO_TYPE (info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM) {
+    switch (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info))) {
+      case GST_EVENT_CAPS:
+      case GST_EVENT_FLUSH_STOP:
+        g_clear_pointer (&cache->last, gst_buffer_unref);
+        break;
+      default:
+        break;
+    }
+    return GST_PAD_PROBE_OK;
+  }
+
+  buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  cache->converting_repeat =
+      gst_mini_object_get_qdata (GST_MINI_OBJECT (buffer),
+                                 repeat_quark ()) != NULL;
+  if (cache->last == NULL || !cache->converting_repeat)
+    return GST_PAD_PROBE_OK;
+
+  /* This runs on the streaming thread that would convert the buffer, so
+   * pushing from here is what the element would have done. */
+  g_atomic_int_inc (&cache->relay->conversions_skipped);
+  gst_pad_push (cache->src_pad, repeat_buffer_new (cache->last, buffer));
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static GstPadProbeReturn
+repeat_src_probe (GstPad          *pad,
+                  GstPadProbeInfo *info,
+                  gpointer         user_data)
+{
+  RepeatCache *cache = (RepeatCache *) user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (gst_mini_object_get_qdata (GST_MINI_OBJECT (buffer),
+                                 repeat_quark ()) != NULL)
+    return GST_PAD_PROBE_OK;
+
+  if (gst_base_transform_is_passthrough (
+          GST_BASE_TRANSFORM (cache->element))) {
+    g_clear_pointer (&cache->last, gst_buffer_unref);
+    return GST_PAD_PROBE_OK;
+  }
+
+  if (buffer->pool != cache->pool) {
+    gst_object_replace ((GstObject **) &cache->pool,
+                        (GstObject *) buffer->pool);
+    cache->pool_bounded = buffer->pool != NULL &&
+        buffer_pool_is_bounded (buffer->pool);
+  }
+  if (!cache->pool_bounded)
+    gst_buffer_replace (&cache->last, buffer);
+  else {
+    g_clear_pointer (&cache->last, gst_buffer_unref);
+    if (cache->converting_repeat)
+      cache->last = buffer_copy_deep (buffer);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Lets videoconvert and videoscale push their last result again in place
+ * of converting a frame the relay found to repeat the previous one. */
+static void
+repeat_probes_add (const GValue *value,
+                   gpointer      user_data)
+{
+  GstElement *element = GST_ELEMENT (g_value_get_object (value));
+  GstElementFactory *factory = gst_element_get_factory (element);
+  const gchar *factory_name;
+  RepeatCache *cache;
+  GstPad *sink_pad;
+
+  if (factory == NULL)
+    return;
+
+  factory_name = gst_plugin_feature_get_name (factory);
+  if (!g_str_equal (factory_name, "videoconvert") &&
+      !g_str_equal (factory_name, "videoscale"))
+    return;
+
+  sink_pad = gst_element_get_static_pad (element, "sink");
+  if (sink_pad == NULL)
+    return;
+
+  cache = g_new0 (RepeatCache, 1);
+  cache->relay = (Relay *) user_data;
+  cache->element = element;
+  cache->src_pad = gst_element_get_static_pad (element, "src");
+  if (cache->src_pad == NULL) {
+    g_free (cache);
+    gst_object_unref (sink_pad);
+    return;
+  }
+  g_object_set_data_full (G_OBJECT (element), "v4l2-relayd-repeat", cache,
+                          (GDestroyNotify) repeat_cache_free);
+
+  gst_pad_add_probe (sink_pad,
+                     GST_PAD_PROBE_TYPE_BUFFER |
+                     GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM,
+                     repeat_sink_probe, cache, NULL);
+  gst_pad_add_probe (cache->src_pad, GST_PAD_PROBE_TYPE_BUFFER,
+                     repeat_src_probe, cache, NULL);
+  gst_object_unref (sink_pad);
+}
+
+static GstElement*
+output_pipeline_create (Relay *relay)
+{
+  GstElement *pipeline, *appsrc;
+  GstClock *clock;
+  GError *error = NULL;
+  gchar *description;
+  GstBus *bus;
+
+  if (relay->card_label != NULL) {
+    gchar *device = v4l2_device_find_by_label (relay->card_label);
+
+    if (device == NULL) {
+      GST_ERROR ("%s: no video device labelled '%s'",
+                 relay->name, relay->card_label);
+      return NULL;
+    }
+    GST_DEBUG ("%s: '%s' is %s", relay->name, relay->card_label, device);
+    description = g_strdup_printf ("%s device=%s", relay->output, device);
+    g_free (relay->device);
+    relay->device = device;
+  } else
+    description = g_strdup (relay->output);
+
+  pipeline = gst_parse_launch (description, &error);
+  g_free (description);
+  if (pipeline == NULL) {
+    GST_ERROR ("%s: %s", relay->name, error->message);
+    g_error_free (error);
+    return NULL;
   }
   gst_object_ref_sink (pipeline);
+  gst_element_set_name (pipeline, "output-pipeline");
+
+  if (trace_enabled) {
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+
+    gst_iterator_foreach (it, trace_probes_add, relay);
+    gst_iterator_free (it);
+  }
+  if (perf_counters_enabled) {
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+
+    gst_iterator_foreach (it, perf_probes_add, NULL);
+    gst_iterator_free (it);
+  }
+  if (relay->dedup != NULL) {
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+
+    gst_iterator_foreach (it, repeat_probes_add, relay);
+    gst_iterator_free (it);
+  }
+
+  appsrc = gst_bin_get_by_name (GST_BIN (pipeline), "appsrc");
+  if (appsrc == NULL) {
+    GST_ERROR ("%s: no element named appsrc in output pipeline",
+               relay->name);
+    gst_object_unref (pipeline);
+    return NULL;
+  }
 
   clock = gst_system_clock_obtain ();
   gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
@@ -425,53 +1912,2177 @@ output_pipeline_create ()
   gst_element_set_start_time (pipeline, GST_CLOCK_TIME_NONE);
   gst_object_unref (clock);
 
+  g_object_set (appsrc,
+                "stream-type", GST_APP_STREAM_TYPE_STREAM,
+                "format", GST_FORMAT_DEFAULT,
+                "is-live", TRUE,
+                "emit-signals", FALSE,
+                NULL);
+  /* Hold the relay back to the pace of the output when benchmarking, so
+   * that a non-live input measures the throughput of the output. */
+  if (opt_bench_run > 0)
+    g_object_set (appsrc, "block", TRUE, NULL);
+  relay->appsrc = appsrc;
+  g_clear_pointer (&relay->output_caps, gst_caps_unref);
+  relay->output_caps = gst_app_src_get_caps (GST_APP_SRC (appsrc));
+  g_clear_pointer (&relay->pushed_caps, gst_caps_unref);
+  g_clear_pointer (&relay->last_flipped, gst_buffer_unref);
+
+  bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+  gst_bus_set_sync_handler (bus, pipeline_bus_sync_handler, relay, NULL);
+  relay->output_bus_watch_id =
+      gst_bus_add_watch (bus, output_pipeline_bus_call, relay);
+  gst_object_unref (bus);
+
+  return pipeline;
+}
+
+static void
+pipeline_destroy (GstElement **pipeline,
+                  guint       *bus_watch_id)
+{
+  if (*bus_watch_id > 0) {
+    g_source_remove (*bus_watch_id);
+    *bus_watch_id = 0;
+  }
+
+  if (*pipeline != NULL) {
+    gst_element_set_state (*pipeline, GST_STATE_NULL);
+    gst_object_unref (GST_OBJECT (*pipeline));
+    *pipeline = NULL;
+  }
+}
+
+static void relay_extra_disable (RelayExtra *extra);
+
+static gboolean
+extra_pipeline_bus_call (GstBus     *bus,
+                         GstMessage *msg,
+                         gpointer    data)
+{
+  RelayExtra *extra = (RelayExtra *) data;
+  Relay *relay = extra->relay;
+
+  switch (GST_MESSAGE_TYPE (msg)) {
+    case GST_MESSAGE_STATE_CHANGED: {
+      GstState new_state;
+
+      if (GST_MESSAGE_SRC (msg) != GST_OBJECT (extra->pipeline))
+        break;
+
+      gst_message_parse_state_changed (msg, NULL, &new_state, NULL);
+      if (new_state == GST_STATE_PLAYING && extra->v4l2_event_poll_id == 0 &&
+          !opt_fake_loopback_control)
+        extra->v4l2_event_poll_id =
+            v4l2sink_watch_clients (relay, extra->pipeline,
+                                    extra_event_callback, extra);
+      break;
+    }
+    case GST_MESSAGE_ERROR: {
+      gchar  *debug;
+      GError *error;
+
+      gst_message_parse_error (msg, &error, &debug);
+      g_free (debug);
+
+      GST_ERROR ("%s: /dev/video%d: %s",
+                 relay->name, extra->device_nr, error->message);
+      g_error_free (error);
+
+      /* Only the extra device goes, the relay keeps streaming. */
+      relay_record_error (relay, msg);
+      relay_extra_disable (extra);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return TRUE;
+}
+
+/* Scales the frames of the main output to the size of @extra. */
+static GstElement*
+extra_pipeline_create (RelayExtra *extra)
+{
+  Relay *relay = extra->relay;
+  GstElement *pipeline, *appsrc, *capsfilter;
+  GstCaps *caps, *scaled_caps;
+  GError *error = NULL;
+  gchar *description;
+  GstClock *clock;
+  GstBus *bus;
+
+  caps = relay->output_caps != NULL ? gst_caps_ref (relay->output_caps) : NULL;
+  if (caps == NULL) {
+    GST_ERROR ("%s: output has no caps to scale extra devices from",
+               relay->name);
+    return NULL;
+  }
+
+  /* Fake devices do not exist, so their frames are scaled and dropped. */
+  if (opt_fake_loopback_control)
+    description = g_strdup ("appsrc name=appsrc ! videoscale ! "
+                            "capsfilter name=capsfilter ! fakesink");
+  else
+    description = g_strdup_printf ("appsrc name=appsrc ! videoscale ! "
+                                   "capsfilter name=capsfilter ! "
+                                   "v4l2sink name=v4l2sink "
+                                   "device=/dev/video%d", extra->device_nr);
+  pipeline = gst_parse_launch (description, &error);
+  g_free (description);
+  if (pipeline == NULL) {
+    GST_ERROR ("%s: %s", relay->name, error->message);
+    g_error_free (error);
+    gst_caps_unref (caps);
+    return NULL;
+  }
+  gst_object_ref_sink (pipeline);
+
+  if (relay->dedup != NULL) {
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (pipeline));
+
+    gst_iterator_foreach (it, repeat_probes_add, relay);
+    gst_iterator_free (it);
+  }
+
   appsrc = gst_bin_get_by_name (GST_BIN (pipeline), "appsrc");
   g_object_set (appsrc,
+                "caps", caps,
                 "stream-type", GST_APP_STREAM_TYPE_STREAM,
                 "format", GST_FORMAT_DEFAULT,
                 "is-live", TRUE,
                 "emit-signals", FALSE,
                 NULL);
-  gst_object_unref (appsrc);
+  extra->appsrc = appsrc;
+
+  scaled_caps = gst_caps_copy (caps);
+  gst_caps_set_simple (scaled_caps,
+                       "width", G_TYPE_INT, extra->width,
+                       "height", G_TYPE_INT, extra->height,
+                       NULL);
+  capsfilter = gst_bin_get_by_name (GST_BIN (pipeline), "capsfilter");
+  g_object_set (capsfilter, "caps", scaled_caps, NULL);
+  gst_object_unref (capsfilter);
+  gst_caps_unref (scaled_caps);
+  gst_caps_unref (caps);
+
+  /* Share the running time of the main output, whose timestamps are
+   * pushed here unchanged. */
+  clock = gst_system_clock_obtain ();
+  gst_pipeline_use_clock (GST_PIPELINE (pipeline), clock);
+  gst_element_set_base_time (pipeline,
+                             gst_element_get_base_time (relay->output_pipeline));
+  gst_element_set_start_time (pipeline, GST_CLOCK_TIME_NONE);
+  gst_object_unref (clock);
 
   bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
-  output_bus_watch_id =
-      gst_bus_add_watch (bus, output_pipeline_bus_call, NULL);
+  gst_bus_set_sync_handler (bus, pipeline_bus_sync_handler, relay, NULL);
+  extra->bus_watch_id = gst_bus_add_watch (bus, extra_pipeline_bus_call,
+                                           extra);
   gst_object_unref (bus);
 
   return pipeline;
 }
 
-int
-main (int   argc,
-      char *argv[])
+static void
+relay_extra_free (RelayExtra *extra)
 {
+  GError *error = NULL;
 
-  parse_args (argc, argv);
+  if (extra->v4l2_event_poll_id > 0)
+    g_source_remove (extra->v4l2_event_poll_id);
+  pipeline_destroy (&extra->pipeline, &extra->bus_watch_id);
+  if (extra->appsrc != NULL)
+    gst_object_unref (extra->appsrc);
 
-  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "V4L2_RELAYD", 0, "v4l2-relayd");
+  if (extra->device_nr >= 0 &&
+      !loopback_control_remove (loopback_control, extra->device_nr, &error)) {
+    GST_WARNING ("%s: %s", extra->relay->name, error->message);
+    g_error_free (error);
+  }
 
-  loop = g_main_loop_new (NULL, FALSE);
-  output_pipeline = output_pipeline_create ();
-  gst_element_set_state (output_pipeline, GST_STATE_PLAYING);
+  g_free (extra);
+}
 
-  GST_INFO ("Running...");
-  g_main_loop_run (loop);
+/* Takes @extra out of service after an error: it loses its clients, its
+ * pipeline and its device. The entry itself, which the streaming threads
+ * may be reading, stays until the relay stops. */
+static void
+relay_extra_disable (RelayExtra *extra)
+{
+  GError *error = NULL;
+
+  if (extra->v4l2_event_poll_id > 0) {
+    g_source_remove (extra->v4l2_event_poll_id);
+    extra->v4l2_event_poll_id = 0;
+  }
+  if (g_atomic_int_get (&extra->clients) > 0)
+    relay_set_clients (extra->relay, extra, 0, g_get_monotonic_time ());
+  pipeline_destroy (&extra->pipeline, &extra->bus_watch_id);
+
+  if (extra->device_nr >= 0 &&
+      !loopback_control_remove (loopback_control, extra->device_nr, &error)) {
+    GST_WARNING ("%s: %s", extra->relay->name, error->message);
+    g_error_free (error);
+  }
+  extra->device_nr = -1;
+}
+
+/* Creates one loopback device per size in the extra-sizes of @relay, each
+ * with its own scaling output. A device that cannot be set up is left out
+ * rather than failing the relay. */
+static void
+relay_extras_start (Relay *relay)
+{
+  gchar **sizes;
+  guint i;
+
+  relay->extras = g_ptr_array_new_with_free_func ((GDestroyNotify)
+                                                  relay_extra_free);
+  if (relay->extra_sizes == NULL)
+    return;
+
+  if (loopback_control == NULL) {
+    GST_WARNING ("%s: extra-sizes needs --loopback-control", relay->name);
+    return;
+  }
+
+  sizes = g_strsplit (relay->extra_sizes, ";", -1);
+  for (i = 0; sizes[i] != NULL; i++) {
+    GError *error = NULL;
+    RelayExtra *extra;
+    guint width, height;
+    gchar *label;
+    gchar end;
+
+    if (*g_strstrip (sizes[i]) == '\0')
+      continue;
+    if (sscanf (sizes[i], "%ux%u%c", &width, &height, &end) != 2 ||
+        width == 0 || height == 0) {
+      GST_WARNING ("%s: invalid extra size '%s'", relay->name, sizes[i]);
+      continue;
+    }
+
+    label = g_strdup_printf ("%s %ux%u",
+                             relay->card_label != NULL ?
+                             relay->card_label : relay->name,
+                             width, height);
+    extra = g_new0 (RelayExtra, 1);
+    extra->relay = relay;
+    extra->width = width;
+    extra->height = height;
+    extra->device_nr = loopback_control_add (loopback_control, label,
+                                             width, height, &error);
+    g_free (label);
+    if (extra->device_nr < 0) {
+      GST_WARNING ("%s: %s", relay->name, error->message);
+      g_error_free (error);
+      g_free (extra);
+      continue;
+    }
+
+    extra->pipeline = extra_pipeline_create (extra);
+    if (extra->pipeline == NULL) {
+      relay_extra_free (extra);
+      continue;
+    }
+
+    GST_INFO ("%s: /dev/video%d relays %ux%u",
+              relay->name, extra->device_nr, width, height);
+    gst_element_set_state (extra->pipeline, GST_STATE_PLAYING);
+    g_ptr_array_add (relay->extras, extra);
+  }
+  g_strfreev (sizes);
+}
+
+static gboolean
+relay_start (Relay *relay)
+{
+  if (relay->output_pipeline == NULL)
+    relay->output_pipeline = output_pipeline_create (relay);
+  if (relay->output_pipeline == NULL)
+    return FALSE;
+  if (relay->extras == NULL)
+    relay_extras_start (relay);
+
+  gst_element_set_state (relay->output_pipeline, GST_STATE_PLAYING);
+  return TRUE;
+}
+
+static void
+relay_stop (Relay *relay)
+{
+  if (relay->restart_id > 0) {
+    g_source_remove (relay->restart_id);
+    relay->restart_id = 0;
+  }
+  if (relay->v4l2_event_poll_id > 0) {
+    g_source_remove (relay->v4l2_event_poll_id);
+    relay->v4l2_event_poll_id = 0;
+  }
 
-  g_source_remove (input_bus_watch_id);
-  g_source_remove (output_bus_watch_id);
-  g_source_remove (splash_bus_watch_id);
+  /* Stop feeding the output first so that it stops on a frame boundary. */
+  pipeline_destroy (&relay->input_pipeline, &relay->input_bus_watch_id);
+  pipeline_destroy (&relay->splash_pipeline, &relay->splash_bus_watch_id);
+  if (relay->extras != NULL) {
+    g_ptr_array_free (relay->extras, TRUE);
+    relay->extras = NULL;
+  }
+  pipeline_destroy (&relay->output_pipeline, &relay->output_bus_watch_id);
+
+  if (relay->handover_fd >= 0) {
+    close (relay->handover_fd);
+    relay->handover_fd = -1;
+  }
+  if (relay->bridge_fd >= 0) {
+    close (relay->bridge_fd);
+    relay->bridge_fd = -1;
+  }
+
+  if (relay->appsrc != NULL) {
+    gst_object_unref (relay->appsrc);
+    relay->appsrc = NULL;
+  }
+  g_clear_pointer (&relay->device, g_free);
+  relay->clients = 0;
+}
+
+/* Looks @key up in the relay @group first, then in its @profile group. */
+static gchar*
+config_get_string (GKeyFile    *keyfile,
+                   const gchar *group,
+                   const gchar *profile,
+                   const gchar *key)
+{
+  gchar *value;
+
+  value = g_key_file_get_string (keyfile, group, key, NULL);
+  if (value == NULL && profile != NULL)
+    value = g_key_file_get_string (keyfile, profile, key, NULL);
+
+  return value;
+}
 
-  gst_element_set_state (output_pipeline, GST_STATE_NULL);
-  gst_object_unref (GST_OBJECT (output_pipeline));
+static gint
+config_get_integer (GKeyFile    *keyfile,
+                    const gchar *group,
+                    const gchar *profile,
+                    const gchar *key,
+                    gint         default_value)
+{
+  if (g_key_file_has_key (keyfile, group, key, NULL))
+    return g_key_file_get_integer (keyfile, group, key, NULL);
+  if (profile != NULL && g_key_file_has_key (keyfile, profile, key, NULL))
+    return g_key_file_get_integer (keyfile, profile, key, NULL);
 
-  gst_element_set_state (input_pipeline, GST_STATE_NULL);
-  gst_object_unref (GST_OBJECT (input_pipeline));
+  return default_value;
+}
 
-  gst_element_set_state (splash_pipeline, GST_STATE_NULL);
-  gst_object_unref (GST_OBJECT (splash_pipeline));
+/* Reads "crop=X;Y;WIDTH;HEIGHT" and "zoom=FACTOR". Returns NULL if
+ * neither is set. */
+static Crop*
+config_get_crop (GKeyFile     *keyfile,
+                 const gchar  *group,
+                 const gchar  *profile,
+                 GError      **error)
+{
+  const gchar *crop_group = NULL, *zoom_group = NULL;
+  gint *rect = NULL;
+  gsize length = 0;
+  gdouble zoom = 1.0;
+  Crop *crop;
+
+  if (g_key_file_has_key (keyfile, group, "crop", NULL))
+    crop_group = group;
+  else if (profile != NULL && g_key_file_has_key (keyfile, profile, "crop",
+                                                  NULL))
+    crop_group = profile;
+  if (g_key_file_has_key (keyfile, group, "zoom", NULL))
+    zoom_group = group;
+  else if (profile != NULL && g_key_file_has_key (keyfile, profile, "zoom",
+                                                  NULL))
+    zoom_group = profile;
+  if (crop_group == NULL && zoom_group == NULL)
+    return NULL;
+
+  if (crop_group != NULL) {
+    rect = g_key_file_get_integer_list (keyfile, crop_group, "crop", &length,
+                                        NULL);
+    if (rect == NULL || length != 4 || rect[2] < 0 || rect[3] < 0) {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "%s: crop must be X;Y;WIDTH;HEIGHT", crop_group);
+      g_free (rect);
+      return NULL;
+    }
+  }
+  if (zoom_group != NULL) {
+    zoom = g_key_file_get_double (keyfile, zoom_group, "zoom", NULL);
+    if (zoom < 1.0) {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "%s: zoom must be 1.0 or more", zoom_group);
+      g_free (rect);
+      return NULL;
+    }
+  }
+
+  crop = rect != NULL ? crop_new (rect[0], rect[1], rect[2], rect[3], zoom) :
+      crop_new (0, 0, 0, 0, zoom);
+  g_free (rect);
+
+  return crop;
+}
+
+/* Builds the output description of a relay from the format, width,
+ * height and framerate keys of its profile. The loopback device is
+ * either given as device= or looked up by card-label= when the relay
+ * starts. Returns NULL with @error unset when no format is configured.
+ * With @scale, the output scales whatever size the crop or the camera
+ * mode leaves back to the size of the device, in the same pass as the
+ * conversion. */
+static gchar*
+config_get_output (GKeyFile     *keyfile,
+                   const gchar  *group,
+                   const gchar  *profile,
+                   gboolean      scale,
+                   gchar       **card_label,
+                   GError      **error)
+{
+  gchar *format, *framerate, *device, *scaler, *output;
+  gint width, height;
+
+  format = config_get_string (keyfile, group, profile, "format");
+  if (format == NULL)
+    return NULL;
+
+  framerate = config_get_string (keyfile, group, profile, "framerate");
+  width = config_get_integer (keyfile, group, profile, "width", 0);
+  height = config_get_integer (keyfile, group, profile, "height", 0);
+  device = config_get_string (keyfile, group, profile, "device");
+  *card_label = config_get_string (keyfile, group, profile, "card-label");
+
+  if (framerate == NULL || width <= 0 || height <= 0 ||
+      (device == NULL && *card_label == NULL)) {
+    g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "%s needs width, height, framerate and either device or "
+                 "card-label along with format", group);
+    g_free (format);
+    g_free (framerate);
+    g_free (device);
+    g_clear_pointer (card_label, g_free);
+    return NULL;
+  }
+
+  scaler = scale ? g_strdup_printf ("videoscale ! video/x-raw,width=%d,"
+                                    "height=%d ! ", width, height) :
+      g_strdup ("");
+  output = g_strdup_printf ("appsrc name=appsrc "
+                            "caps=video/x-raw,format=%s,width=%d,height=%d,"
+                            "framerate=%s ! videoconvert ! %s"
+                            "v4l2sink name=v4l2sink%s%s",
+                            format, width, height, framerate, scaler,
+                            device != NULL ? " device=" : "",
+                            device != NULL ? device : "");
+  g_free (scaler);
+  if (device != NULL)
+    g_clear_pointer (card_label, g_free);
+
+  g_free (format);
+  g_free (framerate);
+  g_free (device);
+
+  return output;
+}
+
+/* Parses a camera-mode value into whether to stream the cheapest mode. */
+static gboolean
+camera_mode_from_string (const gchar *str,
+                         gboolean    *cheapest)
+{
+  if (g_str_equal (str, "output"))
+    *cheapest = FALSE;
+  else if (g_str_equal (str, "cheapest"))
+    *cheapest = TRUE;
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static Relay*
+relay_load (GKeyFile     *keyfile,
+            const gchar  *group,
+            GError      **error)
+{
+  const gchar *name = group + strlen (RELAY_GROUP_PREFIX);
+  gchar *profile_name, *profile = NULL;
+  gchar *input, *output, *splash, *card_label = NULL;
+  GError *local_error = NULL;
+  Relay *relay = NULL;
+  FlipMethod flip = default_flip;
+  gboolean cheapest_mode = default_cheapest_mode;
+  gchar *flip_name, *mode_name;
+  gint dedup, queue_depth;
+  gboolean scales = FALSE;
+  Crop *crop;
+
+  profile_name = g_key_file_get_string (keyfile, group, "profile", NULL);
+  if (profile_name == NULL)
+    profile_name = g_key_file_get_string (keyfile, DAEMON_GROUP, "profile",
+                                          NULL);
+  if (profile_name != NULL) {
+    profile = g_strconcat (PROFILE_GROUP_PREFIX, profile_name, NULL);
+    g_free (profile_name);
+
+    if (!g_key_file_has_group (keyfile, profile)) {
+      g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                   "relay %s refers to missing [%s]", name, profile);
+      g_free (profile);
+      return NULL;
+    }
+  }
+
+  /* Keys left out of both the relay group and its profile fall back to
+   * the command line. */
+  input = config_get_string (keyfile, group, profile, "input");
+  splash = config_get_string (keyfile, group, profile, "splash");
+  output = config_get_string (keyfile, group, profile, "output");
+  crop = config_get_crop (keyfile, group, profile, &local_error);
+  flip_name = config_get_string (keyfile, group, profile, "flip");
+  if (flip_name != NULL && local_error == NULL &&
+      !flip_method_from_string (flip_name, &flip))
+    g_set_error (&local_error, G_KEY_FILE_ERROR,
+                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "relay %s: flip must be none, horizontal, 90, 180 or 270",
+                 name);
+  mode_name = config_get_string (keyfile, group, profile, "camera-mode");
+  if (mode_name != NULL && local_error == NULL &&
+      !camera_mode_from_string (mode_name, &cheapest_mode))
+    g_set_error (&local_error, G_KEY_FILE_ERROR,
+                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "relay %s: camera-mode must be output or cheapest", name);
+  /* Unparsable values come back as 0. */
+  queue_depth = config_get_integer (keyfile, group, profile, "queue-depth",
+                                    DEFAULT_QUEUE_DEPTH);
+  if (queue_depth < 1 && local_error == NULL)
+    g_set_error (&local_error, G_KEY_FILE_ERROR,
+                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "relay %s: queue-depth must be 1 or more", name);
+  if (output == NULL && local_error == NULL) {
+    output = config_get_output (keyfile, group, profile,
+                                crop != NULL || cheapest_mode,
+                                &card_label, &local_error);
+    scales = output != NULL;
+  }
+  /* An output described by hand is not known to scale. */
+  if (crop != NULL && !scales && local_error == NULL)
+    g_set_error (&local_error, G_KEY_FILE_ERROR,
+                 G_KEY_FILE_ERROR_INVALID_VALUE,
+                 "relay %s: crop and zoom need an output built from format, "
+                 "width and height rather than output", name);
+  if (cheapest_mode && !scales && local_error == NULL) {
+    if (mode_name != NULL)
+      g_set_error (&local_error, G_KEY_FILE_ERROR,
+                   G_KEY_FILE_ERROR_INVALID_VALUE,
+                   "relay %s: camera-mode=cheapest needs an output built "
+                   "from format, width and height rather than output",
+                   name);
+    else {
+      GST_WARNING ("%s: Streaming the camera in the output mode, as the "
+                   "output is not built from format, width and height",
+                   name);
+      cheapest_mode = FALSE;
+    }
+  }
+
+  if (local_error != NULL)
+    g_propagate_error (error, local_error);
+  else if ((input == NULL && opt_input == NULL) ||
+           (output == NULL && opt_output == NULL))
+    g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_KEY_NOT_FOUND,
+                 "relay %s needs both an input and an output", name);
+  else {
+    relay = relay_new (name,
+                       input != NULL ? input : opt_input,
+                       output != NULL ? output : opt_output,
+                       splash != NULL ? splash : opt_splash);
+    relay->card_label = card_label;
+    card_label = NULL;
+    relay->queue_depth = queue_depth;
+    relay->extra_sizes = config_get_string (keyfile, group, profile,
+                                            "extra-sizes");
+    relay->decode_threads = MAX (config_get_integer (keyfile, group, profile,
+                                                     "decode-threads",
+                                                     opt_decode_threads), 0);
+    relay->cheapest_mode = cheapest_mode;
+    relay->crop = crop;
+    crop = NULL;
+    if (flip != FLIP_NONE)
+      relay->flip = flip_new (flip);
+    dedup = config_get_integer (keyfile, group, profile, "dedup", opt_dedup);
+    if (dedup > 0)
+      relay->dedup = dedup_new (dedup);
+  }
+
+  g_free (input);
+  g_free (flip_name);
+  g_free (mode_name);
+  g_free (output);
+  g_free (splash);
+  g_free (card_label);
+  g_free (profile);
+  if (crop != NULL)
+    crop_free (crop);
+
+  return relay;
+}
+
+static gboolean
+relays_load_config (const gchar  *path,
+                    GPtrArray    *into,
+                    GError      **error)
+{
+  gboolean loaded = TRUE;
+  GKeyFile *keyfile;
+  gchar **groups;
+  gsize i;
+
+  keyfile = g_key_file_new ();
+  if (!g_key_file_load_from_file (keyfile, path, G_KEY_FILE_NONE, error)) {
+    g_key_file_free (keyfile);
+    return FALSE;
+  }
+
+  config_threads = g_key_file_get_integer (keyfile, DAEMON_GROUP, "threads",
+                                           NULL);
+  g_free (config_cpu_affinity);
+  config_cpu_affinity = g_key_file_get_string (keyfile, DAEMON_GROUP,
+                                               "cpu-affinity", NULL);
+  g_free (config_loopback_control);
+  config_loopback_control = g_key_file_get_string (keyfile, DAEMON_GROUP,
+                                                   "loopback-control", NULL);
+
+  groups = g_key_file_get_groups (keyfile, NULL);
+  for (i = 0; groups[i] != NULL; i++) {
+    Relay *relay;
+
+    if (!g_str_has_prefix (groups[i], RELAY_GROUP_PREFIX))
+      continue;
+
+    relay = relay_load (keyfile, groups[i], error);
+    if (relay == NULL) {
+      loaded = FALSE;
+      break;
+    }
+    g_ptr_array_add (into, relay);
+  }
+  g_strfreev (groups);
+  g_key_file_free (keyfile);
+
+  if (!loaded)
+    return FALSE;
+
+  if (into->len == 0) {
+    g_set_error (error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_GROUP_NOT_FOUND,
+                 "no [%s<name>] groups found", RELAY_GROUP_PREFIX);
+    return FALSE;
+  }
+
+  return TRUE;
+}
+
+static Relay*
+relays_lookup (GPtrArray   *array,
+               const gchar *name)
+{
+  guint i;
+
+  for (i = 0; i < array->len; i++) {
+    Relay *relay = g_ptr_array_index (array, i);
+
+    if (g_strcmp0 (relay->name, name) == 0)
+      return relay;
+  }
+
+  return NULL;
+}
+
+/* Returns the fd client usage events of @relay are subscribed on, owned
+ * by the relay, or -1. */
+static gint
+relay_get_event_fd (Relay *relay)
+{
+  GstElement *v4l2sink;
+  gint fd = -1;
+
+  if (relay->handover_fd >= 0)
+    return relay->handover_fd;
+  if (relay->v4l2_event_poll_id == 0)
+    return -1;
+
+  v4l2sink = gst_bin_get_by_name (GST_BIN (relay->output_pipeline),
+                                  "v4l2sink");
+  if (v4l2sink != NULL) {
+    g_object_get (v4l2sink, "device-fd", &fd, NULL);
+    gst_object_unref (v4l2sink);
+  }
+
+  return fd;
+}
+
+static FlipMethod
+relay_get_flip (Relay *relay)
+{
+  return relay->flip != NULL ? flip_get_method (relay->flip) : FLIP_NONE;
+}
+
+static gboolean
+relay_update_string (gchar       **value,
+                     const gchar  *new_value)
+{
+  if (g_strcmp0 (*value, new_value) == 0)
+    return FALSE;
+
+  g_free (*value);
+  *value = g_strdup (new_value);
+  return TRUE;
+}
+
+/* Rebuilds the output pipeline, and with it everything else, while a
+ * duplicate of the event fd keeps the loopback device open. The crop,
+ * flip and dedup of @config are taken over while nothing streams. */
+static void
+relay_rebuild (Relay *relay,
+               Relay *config)
+{
+  gint fd, bridge_fd = -1;
+
+  fd = relay_get_event_fd (relay);
+  if (fd >= 0)
+    bridge_fd = dup (fd);
+
+  relay_stop (relay);
+  g_clear_pointer (&relay->crop, crop_free);
+  relay->crop = config->crop;
+  config->crop = NULL;
+  g_clear_pointer (&relay->flip, flip_free);
+  relay->flip = config->flip;
+  config->flip = NULL;
+  g_clear_pointer (&relay->dedup, dedup_free);
+  relay->dedup = config->dedup;
+  config->dedup = NULL;
+  relay->cheapest_mode = config->cheapest_mode;
+  relay->bridge_fd = bridge_fd;
+  if (!relay_start (relay))
+    relay_fail (relay);
+}
+
+/* Applies @config to the running @relay, touching only the pipelines
+ * whose description changed. A new queue depth rebuilds both backend
+ * pipelines, a new number of decode threads the input pipeline, and a
+ * new output or device, turning cropping or dedup on or off, a new flip
+ * or a new camera mode selection, the whole relay. A new crop
+ * rectangle, zoom or dedup step applies from the next frame on without
+ * rebuilding anything. */
+static void
+relay_reconfigure (Relay *relay,
+                   Relay *config)
+{
+  gboolean output_changed, depth_changed, decode_changed, changed;
+
+  output_changed = relay_update_string (&relay->output, config->output);
+  output_changed |= relay_update_string (&relay->card_label,
+                                         config->card_label);
+  output_changed |= relay_update_string (&relay->extra_sizes,
+                                         config->extra_sizes);
+  output_changed |= (relay->crop == NULL) != (config->crop == NULL);
+  output_changed |= relay_get_flip (relay) != relay_get_flip (config);
+  output_changed |= (relay->dedup == NULL) != (config->dedup == NULL);
+  output_changed |= relay->cheapest_mode != config->cheapest_mode;
+  depth_changed = relay->queue_depth != config->queue_depth;
+  relay->queue_depth = config->queue_depth;
+  decode_changed = relay->decode_threads != config->decode_threads;
+  relay->decode_threads = config->decode_threads;
+
+  if (output_changed) {
+    GST_INFO ("%s: Output changed, rebuilding relay", relay->name);
+    relay_update_string (&relay->input, config->input);
+    relay_update_string (&relay->splash, config->splash);
+    relay_rebuild (relay, config);
+    return;
+  }
+
+  if (relay->crop != NULL && !crop_equal (relay->crop, config->crop)) {
+    GST_INFO ("%s: Crop changed", relay->name);
+    g_mutex_lock (&relay->transform_lock);
+    crop_update (relay->crop, config->crop);
+    /* The same camera frame now makes a different one. */
+    g_clear_pointer (&relay->last_flipped, gst_buffer_unref);
+    if (relay->dedup != NULL)
+      dedup_reset (relay->dedup);
+    g_mutex_unlock (&relay->transform_lock);
+  }
+
+  if (relay->dedup != NULL &&
+      dedup_get_step (relay->dedup) != dedup_get_step (config->dedup)) {
+    g_mutex_lock (&relay->transform_lock);
+    dedup_set_step (relay->dedup, dedup_get_step (config->dedup));
+    g_mutex_unlock (&relay->transform_lock);
+  }
+
+  changed = relay_update_string (&relay->input, config->input);
+  if ((changed || depth_changed || decode_changed) &&
+      relay->input_pipeline != NULL) {
+    gboolean enabled = input_pipeline_is_enabled (relay);
+
+    GST_INFO ("%s: Input changed, rebuilding input pipeline", relay->name);
+    pipeline_destroy (&relay->input_pipeline, &relay->input_bus_watch_id);
+    if (enabled)
+      input_pipeline_enable (relay);
+  }
+
+  changed = relay_update_string (&relay->splash, config->splash);
+  if ((changed || depth_changed) && relay->splash_pipeline != NULL) {
+    gboolean playing =
+        GST_STATE_TARGET (relay->splash_pipeline) == GST_STATE_PLAYING;
+
+    GST_INFO ("%s: Splash changed, rebuilding splash pipeline", relay->name);
+    pipeline_destroy (&relay->splash_pipeline, &relay->splash_bus_watch_id);
+    if (playing) {
+      GstElement *pipeline = splash_pipeline_get (relay);
+
+      if (pipeline != NULL)
+        gst_element_set_state (pipeline, GST_STATE_PLAYING);
+    }
+  }
+}
+
+/* SIGHUP: re-reads the configuration file and applies the differences
+ * relay by relay. */
+static gboolean
+reload_signal_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  GPtrArray *loaded;
+  GError *error = NULL;
+  guint i;
+
+  /* Command line options cannot be read again. */
+  if (opt_config == NULL) {
+    GST_WARNING ("Ignoring SIGHUP, reloading needs --config");
+    return G_SOURCE_CONTINUE;
+  }
+
+  loaded = g_ptr_array_new_with_free_func ((GDestroyNotify) relay_free);
+  if (!relays_load_config (opt_config, loaded, &error)) {
+    GST_WARNING ("Keeping current configuration: %s", error->message);
+    g_error_free (error);
+    g_ptr_array_free (loaded, TRUE);
+    return G_SOURCE_CONTINUE;
+  }
+
+  for (i = 0; i < relays->len;) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relays_lookup (loaded, relay->name) == NULL) {
+      GST_INFO ("%s: Removed from configuration", relay->name);
+      g_ptr_array_remove_index (relays, i);
+    } else
+      i++;
+  }
+
+  for (i = 0; i < loaded->len; i++) {
+    Relay *config = g_ptr_array_index (loaded, i);
+    Relay *relay = relays_lookup (relays, config->name);
+
+    if (relay != NULL) {
+      relay_reconfigure (relay, config);
+      continue;
+    }
+
+    GST_INFO ("%s: Added to configuration", config->name);
+    relay = relay_dup (config);
+    g_ptr_array_add (relays, relay);
+    if (!relay_start (relay))
+      relay_fail (relay);
+  }
+
+  g_ptr_array_free (loaded, TRUE);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Follows loopback devices of relays configured by card label: a relay
+ * stops as soon as its device is removed and starts again as soon as a
+ * device with its label is added, instead of failing and retrying. */
+static void
+relays_hotplug (const gchar *action,
+                const gchar *devname)
+{
+  gchar *device;
+  guint i;
+
+  device = g_strconcat ("/dev/", devname, NULL);
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relay->card_label == NULL)
+      continue;
+
+    if (g_str_equal (action, "remove") &&
+        g_strcmp0 (relay->device, device) == 0) {
+      GST_INFO ("%s: %s removed, waiting for '%s'",
+                relay->name, device, relay->card_label);
+      relay_stop (relay);
+    } else if (g_str_equal (action, "add") &&
+               relay->output_pipeline == NULL &&
+               v4l2_device_has_label (devname, relay->card_label)) {
+      GST_INFO ("%s: %s added", relay->name, device);
+      relay_stop (relay);
+      if (!relay_start (relay))
+        relay_fail (relay);
+    }
+  }
+
+  g_free (device);
+}
+
+static gboolean
+uevent_cb (GSocket      *socket,
+           GIOCondition  condition G_GNUC_UNUSED,
+           gpointer      user_data G_GNUC_UNUSED)
+{
+  gchar *action, *devname;
+  GError *error = NULL;
+
+  if (!uevent_receive (socket, &action, &devname, &error)) {
+    if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+      GST_WARNING ("Could not receive uevent: %s", error->message);
+    g_error_free (error);
+    return G_SOURCE_CONTINUE;
+  }
+
+  if (action != NULL) {
+    GST_DEBUG ("uevent %s %s", action, devname);
+    relays_hotplug (action, devname);
+  }
+  g_free (action);
+  g_free (devname);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+uevent_start_monitoring ()
+{
+  GError *error = NULL;
+
+  uevent_socket = uevent_open (opt_uevent_socket, &error);
+  if (uevent_socket == NULL) {
+    GST_WARNING ("Not following device hotplug: %s", error->message);
+    g_error_free (error);
+    return;
+  }
+
+  uevent_source = g_socket_create_source (uevent_socket, G_IO_IN, NULL);
+  g_source_set_callback (uevent_source, (GSourceFunc) uevent_cb, NULL, NULL);
+  g_source_attach (uevent_source, NULL);
+}
+
+static void
+uevent_stop_monitoring ()
+{
+  if (uevent_source != NULL) {
+    g_source_destroy (uevent_source);
+    g_source_unref (uevent_source);
+    uevent_source = NULL;
+  }
+  if (uevent_socket != NULL) {
+    g_socket_close (uevent_socket, NULL);
+    g_object_unref (uevent_socket);
+    uevent_socket = NULL;
+    if (opt_uevent_socket != NULL)
+      unlink (opt_uevent_socket);
+  }
+}
+
+/* Returns the numeric value of @key in /proc/self/status, e.g. the
+ * number of Threads or the VmRSS in kB. */
+static guint64
+process_get_status (const gchar *key)
+{
+  gchar *status, *line, *prefix;
+  guint64 value = 0;
+
+  if (!g_file_get_contents ("/proc/self/status", &status, NULL, NULL))
+    return 0;
+
+  prefix = g_strdup_printf ("\n%s:", key);
+  line = strstr (status, prefix);
+  if (line != NULL)
+    value = g_ascii_strtoull (line + strlen (prefix), NULL, 10);
+  g_free (prefix);
+  g_free (status);
+
+  return value;
+}
+
+static guint64
+process_get_fds ()
+{
+  guint64 fds = 0;
+  GDir *dir;
+
+  dir = g_dir_open ("/proc/self/fd", 0, NULL);
+  if (dir == NULL)
+    return 0;
+  while (g_dir_read_name (dir) != NULL)
+    fds++;
+  g_dir_close (dir);
+
+  /* The directory listing itself holds one. */
+  return fds - 1;
+}
+
+/* Returns the number of live GstObjects and GstMiniObjects as seen by
+ * the leaks tracer, or -1 when it is not enabled through GST_TRACERS or
+ * GStreamer is older than 1.18. */
+static gint64
+process_get_gst_objects ()
+{
+  gint64 objects = -1;
+#if GST_CHECK_VERSION (1, 18, 0)
+  GList *tracers, *l;
+
+  tracers = gst_tracing_get_active_tracers ();
+  for (l = tracers; l != NULL; l = l->next) {
+    GstStructure *info = NULL;
+    const GValue *list;
+
+    /* The leaks tracer of older runtimes cannot list live objects. */
+    if (!g_str_equal (G_OBJECT_TYPE_NAME (l->data), "GstLeaksTracer") ||
+        g_signal_lookup ("get-live-objects", G_OBJECT_TYPE (l->data)) == 0)
+      continue;
+
+    g_signal_emit_by_name (l->data, "get-live-objects", &info);
+    if (info == NULL)
+      continue;
+    list = gst_structure_get_value (info, "live-objects-list");
+    if (list != NULL)
+      objects = gst_value_list_get_size (list);
+    gst_structure_free (info);
+  }
+  g_list_free_full (tracers, gst_object_unref);
+#endif
+
+  return objects;
+}
+
+static void
+process_sample (ProcessSample *sample)
+{
+  sample->rss = process_get_status ("VmRSS");
+  sample->fds = process_get_fds ();
+  sample->threads = process_get_status ("Threads");
+  sample->objects = process_get_gst_objects ();
+
+  g_message ("soak: rss=%" G_GUINT64_FORMAT " kB fds=%" G_GUINT64_FORMAT
+             " threads=%" G_GUINT64_FORMAT " objects=%" G_GINT64_FORMAT
+             " events=%d",
+             sample->rss, sample->fds, sample->threads, sample->objects,
+             inject_sent);
+}
+
+static gboolean
+soak_check_growth (const gchar *what,
+                   gint64       first,
+                   gint64       last)
+{
+  gint64 limit = first + MAX (first * opt_soak_tolerance / 100, 1);
+
+  if (last <= limit)
+    return TRUE;
+
+  g_warning ("soak: %s grew from %" G_GINT64_FORMAT " to %" G_GINT64_FORMAT,
+             what, first, last);
+  return FALSE;
+}
+
+/* The first sample is taken one period in, once pools and caches are
+ * warm; every later one only reports progress. */
+static gboolean
+soak_sample_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  ProcessSample sample;
+
+  process_sample (soak_samples == 0 ? &soak_first : &sample);
+  soak_samples++;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+soak_end_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  soak_ended = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Compares the resource usage at the end of a soak with the first
+ * sample. */
+static void
+soak_check ()
+{
+  ProcessSample last;
+
+  if (soak_samples == 0) {
+    g_warning ("soak: too short for --soak-sample %d", opt_soak_sample);
+    soak_failed = TRUE;
+    return;
+  }
+
+  process_sample (&last);
+  if (!soak_check_growth ("rss", soak_first.rss, last.rss) ||
+      !soak_check_growth ("fds", soak_first.fds, last.fds) ||
+      !soak_check_growth ("threads", soak_first.threads, last.threads) ||
+      (soak_first.objects >= 0 &&
+       !soak_check_growth ("objects", soak_first.objects, last.objects)))
+    soak_failed = TRUE;
+}
+
+/* Posts an error on every running input, to go through the recovery on
+ * the next client event. */
+static void
+relays_inject_error ()
+{
+  guint i;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    GError *error;
+
+    if (!input_pipeline_is_enabled (relay))
+      continue;
+
+    error = g_error_new_literal (GST_STREAM_ERROR, GST_STREAM_ERROR_FAILED,
+                                 "Injected failure");
+    gst_element_post_message (relay->input_pipeline,
+        gst_message_new_error (GST_OBJECT (relay->input_pipeline), error,
+                               "--inject-errors"));
+    g_error_free (error);
+  }
+}
+
+/* Drops every stopped input, so that the next client creates it again
+ * through input_pipeline_get. */
+static void
+relays_inject_rebuild ()
+{
+  guint i;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relay->input_pipeline != NULL && !input_pipeline_is_enabled (relay))
+      pipeline_destroy (&relay->input_pipeline, &relay->input_bus_watch_id);
+  }
+}
+
+/* After the last injected event every relay must be back on splash with
+ * no input running, and have relayed a splash frame. Returns whether all
+ * are; with @report, warns about and counts those that are not. */
+static gboolean
+relays_check_consistency (gboolean report)
+{
+  gboolean consistent = TRUE;
+  guint i;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relay->clients == 0 &&
+        (relay->input_pipeline == NULL ||
+         (GST_STATE (relay->input_pipeline) != GST_STATE_PLAYING &&
+          GST_STATE_TARGET (relay->input_pipeline) != GST_STATE_PLAYING)) &&
+        relay->splash_pipeline != NULL &&
+        GST_STATE_TARGET (relay->splash_pipeline) == GST_STATE_PLAYING &&
+        g_atomic_int_get (&relay->switch_pending) == SWITCH_NONE)
+      continue;
+
+    consistent = FALSE;
+    if (!report)
+      continue;
+    g_warning ("%s: inconsistent after churn: clients=%u input=%s splash=%s",
+               relay->name, relay->clients,
+               relay->input_pipeline != NULL ?
+               gst_element_state_get_name (GST_STATE (relay->input_pipeline)) :
+               "none",
+               relay->splash_pipeline != NULL ?
+               gst_element_state_get_name (GST_STATE (relay->splash_pipeline)) :
+               "none");
+    inject_inconsistent++;
+  }
+
+  return consistent;
+}
+
+static void
+inject_sample_rss ()
+{
+  guint64 rss = process_get_status ("VmRSS");
+
+  if (inject_rss_start == 0)
+    inject_rss_start = rss;
+  inject_rss_peak = MAX (inject_rss_peak, rss);
+  inject_rss_time = g_get_monotonic_time ();
+  GST_DEBUG ("rss=%" G_GUINT64_FORMAT " kB after %d events",
+             rss, inject_sent);
+}
+
+/* Alternates the fake client count of every relay between one and zero,
+ * preceded by a burst of random counts when asked to, then waits for
+ * the relays to settle, up to INJECT_SETTLE_TIMEOUT, checks the final
+ * state and leaves the main loop. A soak goes on until its time is up
+ * and the last event was a close. The FIFOs only appear once the
+ * outputs are streaming. */
+static gboolean
+inject_clients_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  gint cycle = inject_sent / 2 + 1;
+  guint i;
+  gint j;
+
+  if (opt_soak > 0 ? soak_ended && inject_sent % 2 == 0 :
+      inject_sent == opt_inject_clients * 2) {
+    /* Stopping the inputs and relaying a splash frame takes a while on
+     * a loaded machine. */
+    if (inject_settle_deadline == 0)
+      inject_settle_deadline = g_get_monotonic_time () +
+          INJECT_SETTLE_TIMEOUT;
+    if (!relays_check_consistency (FALSE) &&
+        g_get_monotonic_time () < inject_settle_deadline)
+      return G_SOURCE_CONTINUE;
+
+    relays_check_consistency (TRUE);
+    inject_sample_rss ();
+    if (opt_soak > 0)
+      soak_check ();
+    g_main_loop_quit (loop);
+    return G_SOURCE_REMOVE;
+  }
+
+  for (i = inject_fds->len; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    gint fd;
+
+    fd = fake_clients_connect (opt_fake_clients, relay->name, NULL);
+    if (fd < 0)
+      return G_SOURCE_CONTINUE;
+    g_array_append_val (inject_fds, fd);
+  }
+
+  if (inject_rss_time == 0 ||
+      g_get_monotonic_time () - inject_rss_time >= G_USEC_PER_SEC)
+    inject_sample_rss ();
+
+  /* Inputs were asked to start one interval ago, or stopped. */
+  if (inject_sent % 2 == 1 && opt_inject_errors > 0 &&
+      cycle % opt_inject_errors == 0)
+    relays_inject_error ();
+  if (inject_sent % 2 == 0 && inject_sent > 0 && opt_inject_rebuild > 0 &&
+      (cycle - 1) % opt_inject_rebuild == 0)
+    relays_inject_rebuild ();
+
+  for (i = 0; i < inject_fds->len; i++) {
+    for (j = opt_inject_burst; j > 0; j--) {
+      GError *error = NULL;
+      guint clients;
+
+      clients = j > 1 ? g_random_int_range (0, 3) : (inject_sent + 1) % 2;
+      if (!fake_clients_send (g_array_index (inject_fds, gint, i),
+                              clients, &error)) {
+        GST_WARNING ("%s", error->message);
+        g_error_free (error);
+      }
+    }
+  }
+  inject_sent++;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static guint
+relays_get_frames ()
+{
+  guint i, frames = 0;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    frames += (guint) g_atomic_int_get (&relay->frames);
+  }
+
+  return frames;
+}
+
+static guint64
+process_get_minor_faults ()
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return usage.ru_minflt;
+}
+
+/* CPU time of all threads, in microseconds. */
+static gint64
+process_get_cpu_time ()
+{
+  struct rusage usage;
+
+  if (getrusage (RUSAGE_SELF, &usage) != 0)
+    return 0;
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * G_USEC_PER_SEC +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/* glibc has no allocation counter, so freshly touched pages stand in
+ * for allocations per frame. */
+static void
+bench_run_finish (gint64 now)
+{
+  const gchar *group = opt_bench_group != NULL ? opt_bench_group : "default";
+  guint frames = relays_get_frames () - bench_run_frames;
+  gdouble seconds = (gdouble) (now - bench_run_start) / G_USEC_PER_SEC;
+
+  bench_results = g_key_file_new ();
+  g_key_file_set_double (bench_results, group, "fps",
+                         frames / seconds / relays->len);
+  g_key_file_set_double (bench_results, group, "relay-p50-us",
+                         bench_stats_get_percentile (bench_frame, 50));
+  g_key_file_set_double (bench_results, group, "relay-p99-us",
+                         bench_stats_get_percentile (bench_frame, 99));
+  g_key_file_set_double (bench_results, group, "faults-per-frame",
+                         frames > 0 ? (gdouble) (process_get_minor_faults () -
+                                                 bench_run_faults) / frames
+                                    : 0.0);
+  g_key_file_set_double (bench_results, group, "cpu-us-per-frame",
+                         frames > 0 ? (gdouble) (process_get_cpu_time () -
+                                                 bench_run_cpu) / frames
+                                    : 0.0);
+  g_key_file_set_double (bench_results, group, "rss-kb",
+                         process_get_status ("VmRSS"));
+}
+
+/* Opens a client on every relay as soon as its FIFO appears, and
+ * measures for opt_bench_run seconds once the inputs had BENCH_WARMUP
+ * seconds to start. */
+static gboolean
+bench_run_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  for (i = inject_fds->len; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    GError *error = NULL;
+    gint fd;
+
+    fd = fake_clients_connect (opt_fake_clients, relay->name, NULL);
+    if (fd < 0)
+      return G_SOURCE_CONTINUE;
+    g_array_append_val (inject_fds, fd);
+    if (!fake_clients_send (fd, 1, &error)) {
+      GST_WARNING ("%s", error->message);
+      g_error_free (error);
+    }
+  }
+
+  if (bench_run_warm == 0) {
+    bench_run_warm = now + BENCH_WARMUP * G_USEC_PER_SEC;
+    return G_SOURCE_CONTINUE;
+  }
+
+  if (bench_run_start == 0) {
+    if (now < bench_run_warm)
+      return G_SOURCE_CONTINUE;
+    bench_run_start = now;
+    bench_run_frames = relays_get_frames ();
+    bench_run_faults = process_get_minor_faults ();
+    bench_run_cpu = process_get_cpu_time ();
+    g_atomic_int_set (&bench_measuring, TRUE);
+    return G_SOURCE_CONTINUE;
+  }
+
+  if (now - bench_run_start < opt_bench_run * G_USEC_PER_SEC)
+    return G_SOURCE_CONTINUE;
+
+  g_atomic_int_set (&bench_measuring, FALSE);
+  bench_run_finish (now);
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+bench_run_report ()
+{
+  const gchar *group = opt_bench_group != NULL ? opt_bench_group : "default";
+  GError *error = NULL;
+  guint regressions;
+
+  if (opt_bench_results != NULL) {
+    gchar *data = g_key_file_to_data (bench_results, NULL, NULL);
+
+    if (!g_file_set_contents (opt_bench_results, data, -1, &error)) {
+      g_warning ("Could not write %s: %s", opt_bench_results, error->message);
+      g_clear_error (&error);
+      bench_failed = TRUE;
+    }
+    g_free (data);
+  }
+
+  if (opt_bench_baseline == NULL) {
+    gchar **keys = g_key_file_get_keys (bench_results, group, NULL, NULL);
+    guint i;
+
+    for (i = 0; keys != NULL && keys[i] != NULL; i++)
+      g_message ("%s: %s=%.2f", group, keys[i],
+                 g_key_file_get_double (bench_results, group, keys[i], NULL));
+    g_strfreev (keys);
+    return;
+  }
+
+  if (!bench_check_baseline (bench_results, opt_bench_baseline, group,
+                             &regressions, &error)) {
+    g_warning ("Could not check %s: %s", opt_bench_baseline, error->message);
+    g_error_free (error);
+    bench_failed = TRUE;
+  } else if (regressions > 0) {
+    g_warning ("%s: %u regression(s) against %s",
+               group, regressions, opt_bench_baseline);
+    bench_failed = TRUE;
+  }
+}
+
+/* SIGUSR1: writes the flight recorder. */
+static gboolean
+recorder_signal_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  recorder_write ("SIGUSR1");
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Reports, once per stall, a relay whose input is meant to be running
+ * but has not relayed a frame for opt_watchdog seconds. */
+static gboolean
+watchdog_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  gint64 now = g_get_monotonic_time ();
+  guint i;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    guint frames = (guint) g_atomic_int_get (&relay->frames);
+
+    if (!input_pipeline_is_enabled (relay) ||
+        frames != relay->watchdog_frames) {
+      relay->watchdog_frames = frames;
+      relay->watchdog_time = now;
+      relay->watchdog_fired = FALSE;
+      continue;
+    }
+
+    if (!relay->watchdog_fired &&
+        now - relay->watchdog_time >= opt_watchdog * G_USEC_PER_SEC) {
+      gchar *reason;
+
+      relay->watchdog_fired = TRUE;
+      reason = g_strdup_printf ("%s: no frame for %d seconds",
+                                relay->name, opt_watchdog);
+      GST_WARNING ("%s", reason);
+      recorder_write (reason);
+      g_free (reason);
+    }
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* SIGUSR2: writes the trace recorded so far. */
+static gboolean
+trace_signal_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  GError *error = NULL;
+
+  if (!trace_write_json (opt_trace, &error)) {
+    GST_WARNING ("Could not write trace: %s", error->message);
+    g_error_free (error);
+  } else
+    g_message ("Trace written to %s", opt_trace);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+shutdown_timeout_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  shutdown_timeout_id = 0;
+  GST_WARNING ("%u relay(s) did not drain in time", shutdown_draining);
+  g_main_loop_quit (loop);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* SIGTERM/SIGINT: push EOS into every streaming output and leave the main
+ * loop once all of them drained, or after half of the shutdown timeout.
+ * The other half is left for tearing the pipelines down. */
+static gboolean
+shutdown_signal_cb (gpointer user_data G_GNUC_UNUSED)
+{
+  guint i;
+
+  if (shutdown_start > 0) {
+    g_main_loop_quit (loop);
+    return G_SOURCE_CONTINUE;
+  }
+
+  shutdown_start = g_get_monotonic_time ();
+  GST_INFO ("Shutting down");
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relay->restart_id > 0) {
+      g_source_remove (relay->restart_id);
+      relay->restart_id = 0;
+    }
+    if (relay->output_pipeline == NULL ||
+        GST_STATE (relay->output_pipeline) != GST_STATE_PLAYING)
+      continue;
+
+    relay->draining = TRUE;
+    shutdown_draining++;
+    gst_app_src_end_of_stream (GST_APP_SRC (relay->appsrc));
+  }
+
+  if (shutdown_draining == 0)
+    g_main_loop_quit (loop);
+  else
+    shutdown_timeout_id = g_timeout_add (MAX (opt_shutdown_timeout / 2, 1),
+                                         shutdown_timeout_cb, NULL);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static struct
+{
+  GMutex lock;
+  GCond  cond;
+  guint  pending;
+} teardown;
+
+static gpointer
+pipeline_teardown_thread (gpointer data)
+{
+  GstElement *pipeline = GST_ELEMENT (data);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  g_mutex_lock (&teardown.lock);
+  teardown.pending--;
+  g_cond_signal (&teardown.cond);
+  g_mutex_unlock (&teardown.lock);
+
+  return NULL;
+}
+
+static void
+pipeline_teardown_async (GstElement *pipeline)
+{
+  if (pipeline == NULL)
+    return;
+
+  g_mutex_lock (&teardown.lock);
+  teardown.pending++;
+  g_mutex_unlock (&teardown.lock);
+
+  g_thread_unref (g_thread_new ("teardown", pipeline_teardown_thread,
+                                gst_object_ref (pipeline)));
+}
+
+/* Brings every pipeline of every relay to NULL concurrently, so that slow
+ * camera sources do not add up. Returns FALSE if some pipeline is still
+ * stopping at @deadline. */
+static gboolean
+relays_teardown (gint64 deadline)
+{
+  gboolean done;
+  guint i, j;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    pipeline_teardown_async (relay->input_pipeline);
+    pipeline_teardown_async (relay->splash_pipeline);
+    for (j = 0; relay->extras != NULL && j < relay->extras->len; j++) {
+      RelayExtra *extra = g_ptr_array_index (relay->extras, j);
+
+      pipeline_teardown_async (extra->pipeline);
+    }
+    pipeline_teardown_async (relay->output_pipeline);
+  }
+
+  g_mutex_lock (&teardown.lock);
+  while (teardown.pending > 0) {
+    if (!g_cond_wait_until (&teardown.cond, &teardown.lock, deadline))
+      break;
+  }
+  done = teardown.pending == 0;
+  g_mutex_unlock (&teardown.lock);
+
+  return done;
+}
+
+static gboolean
+handover_expect (GSocket      *socket,
+                 const gchar  *expected,
+                 GError      **error)
+{
+  gchar *line;
+  gint fd;
+
+  line = handover_receive (socket, &fd, error);
+  if (line == NULL)
+    return FALSE;
+  if (fd >= 0)
+    close (fd);
+
+  if (g_strcmp0 (line, expected) != 0) {
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                 "expected %s, got %s", expected, line);
+    g_free (line);
+    return FALSE;
+  }
+  g_free (line);
+
+  return TRUE;
+}
+
+static void
+handover_stop_listening ()
+{
+  if (handover_source != NULL) {
+    g_source_destroy (handover_source);
+    g_source_unref (handover_source);
+    handover_source = NULL;
+  }
+  if (handover_socket != NULL) {
+    g_socket_close (handover_socket, NULL);
+    g_object_unref (handover_socket);
+    handover_socket = NULL;
+    unlink (opt_handover_socket);
+  }
+}
+
+/* Old daemon side: passes every relay's event fd and client count to the
+ * new daemon, then stops streaming once the new daemon is ready to take
+ * the output over and quits. The dup'ed event fds keep the loopback
+ * devices open in between, so consumers never see the writer go away. */
+static gboolean
+relays_hand_over (GSocket  *peer,
+                  GError  **error)
+{
+  guint i;
+
+  if (!handover_expect (peer, "HANDOVER", error))
+    return FALSE;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    gchar *line;
+    gboolean sent;
+
+    line = g_strdup_printf ("RELAY %u %s", relay->clients, relay->name);
+    sent = handover_send (peer, line, relay_get_event_fd (relay), error);
+    g_free (line);
+    if (!sent)
+      return FALSE;
+  }
+
+  if (!handover_send (peer, "END", -1, error) ||
+      !handover_expect (peer, "RELEASE", error))
+    return FALSE;
+
+  GST_INFO ("Handing %u relay(s) over", relays->len);
+  handover_stop_listening ();
+  for (i = 0; i < relays->len; i++)
+    relay_stop (g_ptr_array_index (relays, i));
+
+  handover_send (peer, "RELEASED", -1, NULL);
+  g_main_loop_quit (loop);
+
+  return TRUE;
+}
+
+static gboolean
+handover_accept_cb (GSocket      *socket,
+                    GIOCondition  condition G_GNUC_UNUSED,
+                    gpointer      user_data G_GNUC_UNUSED)
+{
+  GError *error = NULL;
+  GSocket *peer;
+
+  peer = g_socket_accept (socket, NULL, &error);
+  if (peer == NULL) {
+    GST_WARNING ("Could not accept handover connection: %s", error->message);
+    g_error_free (error);
+    return G_SOURCE_CONTINUE;
+  }
+
+  g_socket_set_timeout (peer, HANDOVER_TIMEOUT);
+  if (!relays_hand_over (peer, &error)) {
+    GST_WARNING ("Handover failed: %s", error->message);
+    g_error_free (error);
+  }
+  g_object_unref (peer);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+handover_start_listening (GError **error)
+{
+  handover_socket = handover_listen (opt_handover_socket, error);
+  if (handover_socket == NULL)
+    return FALSE;
+
+  handover_source = g_socket_create_source (handover_socket, G_IO_IN, NULL);
+  g_source_set_callback (handover_source, (GSourceFunc) handover_accept_cb,
+                         NULL, NULL);
+  g_source_attach (handover_source, NULL);
+
+  return TRUE;
+}
+
+/* New daemon side: collects the event fds and client counts of the
+ * running daemon, builds the output pipelines up to READY and only then
+ * asks the old daemon to release the devices. The devices stay open, but
+ * v4l2sink opens them again and restarts streaming, so consumers see a
+ * pause of one STREAMON plus the input startup. */
+static gboolean
+relays_take_over (const gchar  *path,
+                  GError      **error)
+{
+  GSocket *socket;
+  gint64 start;
+  guint i;
+
+  socket = handover_connect (path, error);
+  if (socket == NULL)
+    return FALSE;
+
+  if (!handover_send (socket, "HANDOVER", -1, error))
+    goto failed;
+
+  while (TRUE) {
+    gchar *line, *name;
+    Relay *relay;
+    guint clients = 0;
+    gint fd;
+
+    line = handover_receive (socket, &fd, error);
+    if (line == NULL)
+      goto failed;
+    if (g_strcmp0 (line, "END") == 0) {
+      g_free (line);
+      break;
+    }
+
+    name = NULL;
+    if (g_str_has_prefix (line, "RELAY ")) {
+      clients = (guint) g_ascii_strtoull (line + strlen ("RELAY "),
+                                          &name, 10);
+      if (name != NULL && *name == ' ')
+        name++;
+      else
+        name = NULL;
+    }
+
+    relay = name != NULL ? relays_lookup (relays, name) : NULL;
+    if (relay != NULL && relay->handover_fd < 0 && fd >= 0) {
+      GST_DEBUG ("%s: Taking over with %u client(s)", relay->name, clients);
+      relay->handover_fd = fd;
+      relay->clients = clients;
+    } else {
+      GST_WARNING ("Ignoring handover of '%s'", line);
+      if (fd >= 0)
+        close (fd);
+    }
+    g_free (line);
+  }
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    relay->output_pipeline = output_pipeline_create (relay);
+    if (relay->output_pipeline != NULL)
+      gst_element_set_state (relay->output_pipeline, GST_STATE_READY);
+  }
+
+  start = g_get_monotonic_time ();
+  if (!handover_send (socket, "RELEASE", -1, error) ||
+      !handover_expect (socket, "RELEASED", error))
+    goto failed;
+  GST_INFO ("Previous daemon released its relays in %" G_GINT64_FORMAT " us",
+            g_get_monotonic_time () - start);
+
+  g_socket_close (socket, NULL);
+  g_object_unref (socket);
+  return TRUE;
+
+failed:
+  g_socket_close (socket, NULL);
+  g_object_unref (socket);
+  return FALSE;
+}
+
+static gboolean
+relays_print_stats (gpointer user_data G_GNUC_UNUSED)
+{
+  static guint64 last_switches = 0;
+  static guint last_frames = 0;
+  struct rusage usage;
+  guint64 switches = 0;
+  gdouble switches_per_frame = 0.0;
+  guint i, frames = 0;
+
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+    guint relay_frames = (guint) g_atomic_int_get (&relay->frames);
+
+    g_message ("%s: frames=%u clients=%u events=%u actions=%u errors=%u "
+               "restarts=%u bus-forwarded=%u bus-filtered=%u duplicates=%u "
+               "conversions-skipped=%u",
+               relay->name, relay_frames, relay->clients,
+               relay->events, relay->actions, relay->errors, relay->restarts,
+               (guint) g_atomic_int_get (&relay->bus_forwarded),
+               (guint) g_atomic_int_get (&relay->bus_filtered),
+               (guint) g_atomic_int_get (&relay->duplicates),
+               (guint) g_atomic_int_get (&relay->conversions_skipped));
+    if (relay->input_pipeline != NULL) {
+      Decoder *decoder = g_object_get_data (G_OBJECT (relay->input_pipeline),
+                                            "decoder");
+      DecoderStats stats;
+
+      if (decoder != NULL) {
+        decoder_get_stats (decoder, &stats);
+        g_message ("%s: decoded=%u decode-skipped=%u decode-dropped=%u "
+                   "decode-late=%u decode-errors=%u", relay->name,
+                   stats.decoded, stats.skipped, stats.dropped, stats.late,
+                   stats.errors);
+      }
+    }
+    frames += relay_frames;
+  }
+
+  /* Voluntary and involuntary switches of all threads of the process,
+   * averaged over the frames relayed since the last report. */
+  if (getrusage (RUSAGE_SELF, &usage) == 0)
+    switches = usage.ru_nvcsw + usage.ru_nivcsw;
+  if (frames > last_frames)
+    switches_per_frame =
+        (gdouble) (switches - last_switches) / (frames - last_frames);
+
+  if (task_pool != NULL) {
+    guint active, peak, max_threads;
+
+    relay_task_pool_get_usage (RELAY_TASK_POOL (task_pool),
+                               &active, &peak, &max_threads);
+    g_message ("threads=%" G_GUINT64_FORMAT " pool=%u/%u peak=%u "
+               "cswch/frame=%.2f",
+               process_get_status ("Threads"), active, max_threads, peak,
+               switches_per_frame);
+  } else
+    g_message ("threads=%" G_GUINT64_FORMAT " cswch/frame=%.2f",
+               process_get_status ("Threads"), switches_per_frame);
+
+  last_switches = switches;
+  last_frames = frames;
+
+  return G_SOURCE_CONTINUE;
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  guint stats_id = 0;
+  guint i, started;
+
+  parse_args (argc, argv);
+
+  if ((opt_inject_clients > 0 || opt_soak > 0 || opt_bench_run > 0) &&
+      opt_fake_clients == NULL) {
+    g_printerr ("--inject-clients, --soak and --bench-run need --fake-clients\n");
+    exit (1);
+  }
+  if (opt_bench_run > 0 && (opt_inject_clients > 0 || opt_soak > 0)) {
+    g_printerr ("--bench-run cannot be combined with --inject-clients or --soak\n");
+    exit (1);
+  }
+
+  if (opt_startup_delay != NULL) {
+    gchar end;
+
+    switch (sscanf (opt_startup_delay, "%d-%d%c",
+                    &startup_delay_min, &startup_delay_max, &end)) {
+      case 1:
+        startup_delay_max = startup_delay_min;
+        break;
+      case 2:
+        break;
+      default:
+        startup_delay_max = -1;
+        break;
+    }
+    if (startup_delay_min < 0 || startup_delay_max < startup_delay_min) {
+      g_printerr ("Invalid startup delay '%s'\n", opt_startup_delay);
+      exit (1);
+    }
+  }
+
+  if (opt_flip != NULL && !flip_method_from_string (opt_flip, &default_flip)) {
+    g_printerr ("Invalid flip '%s'\n", opt_flip);
+    exit (1);
+  }
+  if (opt_camera_mode != NULL &&
+      !camera_mode_from_string (opt_camera_mode, &default_cheapest_mode)) {
+    g_printerr ("Invalid camera mode '%s'\n", opt_camera_mode);
+    exit (1);
+  }
+  /* The output of the command line relay is not known to scale. */
+  if (default_cheapest_mode && opt_config == NULL) {
+    g_printerr ("--camera-mode cheapest needs --config\n");
+    exit (1);
+  }
+
+  GST_DEBUG_CATEGORY_INIT (GST_CAT_DEFAULT, "V4L2_RELAYD", 0, "v4l2-relayd");
+
+  if (opt_trace != NULL)
+    trace_init (MAX (opt_trace_events, 1));
+
+  if (opt_perf_counters) {
+    GError *error = NULL;
+
+    if (!perf_counters_init (&error)) {
+      g_printerr ("%s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+  }
+
+  recorder_init (RECORDER_EVENTS);
+  if (opt_recorder_file == NULL)
+    opt_recorder_file = g_build_filename (g_get_tmp_dir (),
+                                          "v4l2-relayd-recorder.log", NULL);
+
+  relays = g_ptr_array_new_with_free_func ((GDestroyNotify) relay_free);
+  if (opt_config != NULL) {
+    GError *error = NULL;
+
+    if (!relays_load_config (opt_config, relays, &error)) {
+      g_printerr ("Could not load %s: %s\n", opt_config, error->message);
+      g_error_free (error);
+      exit (1);
+    }
+
+    /* The command line takes precedence over the [daemon] group. */
+    if (opt_threads == 0)
+      opt_threads = config_threads;
+    if (opt_cpu_affinity == NULL)
+      opt_cpu_affinity = g_strdup (config_cpu_affinity);
+    if (opt_loopback_control == NULL)
+      opt_loopback_control = g_strdup (config_loopback_control);
+  } else {
+    Relay *relay = relay_new ("default", opt_input, opt_output, opt_splash);
+
+    if (default_flip != FLIP_NONE)
+      relay->flip = flip_new (default_flip);
+    if (opt_dedup > 0)
+      relay->dedup = dedup_new (opt_dedup);
+    relay->decode_threads = MAX (opt_decode_threads, 0);
+    g_ptr_array_add (relays, relay);
+  }
+
+  if (opt_threads > 0) {
+    GError *error = NULL;
+
+    task_pool = relay_task_pool_new (opt_threads, opt_cpu_affinity, &error);
+    if (task_pool == NULL) {
+      g_printerr ("Could not create task pool: %s\n", error->message);
+      g_error_free (error);
+      exit (1);
+    }
+  }
+
+  if (opt_fake_loopback_control)
+    loopback_control = loopback_control_fake_new ();
+  else if (opt_loopback_control != NULL) {
+    GError *error = NULL;
+
+    loopback_control = loopback_control_open (opt_loopback_control, &error);
+    if (loopback_control == NULL) {
+      GST_WARNING ("Not creating extra devices: %s", error->message);
+      g_error_free (error);
+    }
+  }
+
+  loop = g_main_loop_new (NULL, FALSE);
+
+  if (opt_takeover != NULL) {
+    GError *error = NULL;
+
+    if (!relays_take_over (opt_takeover, &error)) {
+      g_printerr ("Could not take over from %s: %s\n",
+                  opt_takeover, error->message);
+      g_error_free (error);
+      exit (1);
+    }
+  }
+
+  started = 0;
+  for (i = 0; i < relays->len; i++) {
+    Relay *relay = g_ptr_array_index (relays, i);
+
+    if (relay_start (relay))
+      started++;
+    else if (opt_config != NULL)
+      relay_fail (relay);
+  }
+  if (started == 0 && opt_config == NULL)
+    exit (1);
+
+  if (opt_handover_socket != NULL) {
+    GError *error = NULL;
+
+    if (!handover_start_listening (&error)) {
+      GST_WARNING ("Could not listen on %s: %s",
+                   opt_handover_socket, error->message);
+      g_error_free (error);
+    }
+  }
+
+  /* Only relays from a configuration file follow devices by label. */
+  if (opt_config != NULL)
+    uevent_start_monitoring ();
+
+  g_unix_signal_add (SIGTERM, shutdown_signal_cb, NULL);
+  g_unix_signal_add (SIGINT, shutdown_signal_cb, NULL);
+  g_unix_signal_add (SIGHUP, reload_signal_cb, NULL);
+  g_unix_signal_add (SIGUSR1, recorder_signal_cb, NULL);
+  if (opt_trace != NULL)
+    g_unix_signal_add (SIGUSR2, trace_signal_cb, NULL);
+  if (opt_watchdog > 0)
+    g_timeout_add_seconds (1, watchdog_cb, NULL);
+
+  if (opt_stats_interval > 0)
+    stats_id = g_timeout_add_seconds (opt_stats_interval,
+                                      relays_print_stats, NULL);
+
+  if (opt_soak > 0) {
+    g_timeout_add_seconds (MAX (opt_soak_sample, 1), soak_sample_cb, NULL);
+    g_timeout_add_seconds (opt_soak, soak_end_cb, NULL);
+  }
+
+  if (opt_inject_clients > 0 || opt_soak > 0) {
+    bench_live = bench_stats_new ("client to first live frame");
+    bench_splash = bench_stats_new ("last client to splash");
+    bench_event = bench_stats_new ("event handling");
+    bench_state = bench_stats_new ("input to PLAYING");
+    inject_fds = g_array_new (FALSE, FALSE, sizeof (gint));
+    g_timeout_add (MAX (opt_inject_interval, 1), inject_clients_cb, NULL);
+  }
+
+  if (opt_bench_run > 0) {
+    bench_frame = bench_stats_new ("relay");
+    inject_fds = g_array_new (FALSE, FALSE, sizeof (gint));
+    g_timeout_add (100, bench_run_cb, NULL);
+  }
+
+  GST_INFO ("Running %u relay(s)...", relays->len);
+  g_main_loop_run (loop);
+
+  if (stats_id > 0)
+    g_source_remove (stats_id);
+  if (shutdown_timeout_id > 0)
+    g_source_remove (shutdown_timeout_id);
+  handover_stop_listening ();
+  uevent_stop_monitoring ();
+
+  if (inject_fds != NULL) {
+    for (i = 0; i < inject_fds->len; i++)
+      close (g_array_index (inject_fds, gint, i));
+    g_array_free (inject_fds, TRUE);
+    inject_fds = NULL;
+  }
+
+  if (shutdown_start == 0)
+    shutdown_start = g_get_monotonic_time ();
+  if (!relays_teardown (shutdown_start + opt_shutdown_timeout * 1000)) {
+    g_warning ("Pipelines still stopping after %d ms, exiting anyway",
+               opt_shutdown_timeout);
+    return 1;
+  }
+  g_message ("Stopped in %.1f ms",
+             (g_get_monotonic_time () - shutdown_start) / 1000.0);
+
+  if (perf_counters_enabled)
+    perf_counters_print ();
+
+  if (bench_results != NULL) {
+    bench_run_report ();
+    g_clear_pointer (&bench_results, g_key_file_free);
+  }
+  g_clear_pointer (&bench_frame, bench_stats_free);
+
+  if (bench_live != NULL) {
+    bench_stats_print (bench_event);
+    bench_stats_print (bench_state);
+    bench_stats_print (bench_live);
+    bench_stats_print_distribution (bench_live);
+    bench_stats_print (bench_splash);
+    bench_stats_print_distribution (bench_splash);
+    g_message ("rss: start=%" G_GUINT64_FORMAT " peak=%" G_GUINT64_FORMAT
+               " end=%" G_GUINT64_FORMAT " kB",
+               inject_rss_start, inject_rss_peak, process_get_status ("VmRSS"));
+    g_clear_pointer (&bench_event, bench_stats_free);
+    g_clear_pointer (&bench_state, bench_stats_free);
+    g_clear_pointer (&bench_live, bench_stats_free);
+    g_clear_pointer (&bench_splash, bench_stats_free);
+  }
+
+  g_ptr_array_free (relays, TRUE);
+  relays = NULL;
+
+  if (loopback_control != NULL) {
+    loopback_control_free (loopback_control);
+    loopback_control = NULL;
+  }
+
+  if (task_pool != NULL) {
+    gst_task_pool_cleanup (task_pool);
+    gst_object_unref (task_pool);
+    task_pool = NULL;
+  }
 
   g_main_loop_unref (loop);
 
-  return 0;
+  return inject_inconsistent > 0 || soak_failed || bench_failed ? 1 : 0;
 }